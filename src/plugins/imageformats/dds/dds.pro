@@ -1,6 +1,7 @@
 TARGET = qdds
 TEMPLATE = lib
 CONFIG += qt plugin
+QT += concurrent
 DESTDIR = ../../../../imageformats
 
 win32:RC_FILE += dds.rc
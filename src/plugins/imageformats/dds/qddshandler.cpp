@@ -40,13 +40,39 @@
 
 #include "qddshandler.h"
 
+#include <QtCore/qbuffer.h>
+#include <QtCore/qcache.h>
+#include <QtCore/qdatetime.h>
 #include <QtCore/qdebug.h>
+#include <QtCore/qendian.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qfileinfo.h>
+#include <QtCore/qfutureinterface.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qsharedpointer.h>
+#include <QtCore/qthreadpool.h>
+#include <QtConcurrent/qtconcurrentmap.h>
+#include <QtConcurrent/qtconcurrentrun.h>
 #include <QtGui/qimage.h>
 
 #include <cmath>
+#include <limits>
 
 #include "ddsheader.h"
 
+#if defined(Q_PROCESSOR_X86) && defined(Q_CC_GNU)
+#define DDS_X86_DISPATCH
+#define DDS_TARGET(features) __attribute__((target(features)))
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <cmath>
 
 #ifndef QT_NO_DATASTREAM
@@ -76,8 +102,14 @@ static const quint32 ddsMagic = 0x20534444; // "DDS "
 static const quint32 dx10Magic = 0x30315844; // "DX10"
 
 static const qint64 headerSize = 128;
+static const qint64 header10Size = 20;
 static const quint32 ddsSize = 124; // headerSize without magic
+static const int fourCCOffset = 84; // magic, 19 header fields, pixel format size and flags
 static const quint32 pixelFormatSize = 32;
+static const quint32 maxMipmapCount = 32;
+static const quint32 maxArraySize = 2048; // D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION
+static const quint32 maxDepth = 2048; // D3D11_REQ_TEXTURE3D_U_V_OR_W_DIMENSION
+static const qint64 maxSubresourceCount = 65536;
 
 struct FaceOffset
 {
@@ -283,16 +315,13 @@ static inline int maskLength(quint32 mask)
     return result;
 }
 
-static inline quint32 readValue(QDataStream &s, quint32 size)
+static inline quint32 readValue(const uchar *data, quint32 size)
 {
     Q_ASSERT(size == 8 || size == 16 || size == 24 || size == 32);
 
     quint32 value = 0;
-    quint8 tmp;
-    for (unsigned bit = 0; bit < size; bit += 8) {
-        s >> tmp;
-        value += (quint32(tmp) << bit);
-    }
+    for (unsigned bit = 0; bit < size; bit += 8)
+        value += (quint32(*data++) << bit);
     return value;
 }
 
@@ -306,11 +335,52 @@ static inline bool isCubeMap(const DDSHeader &dds)
     return (dds.caps2 & DDSHeader::Caps2CubeMap) != 0;
 }
 
-static inline QRgb yuv2rgb(quint8 Y, quint8 U, quint8 V)
+// Analog YUV to RGB with full range Y, in 13-bit fixed point
+struct YuvCoefficients
+{
+    int rv;
+    int gu;
+    int gv;
+    int bu;
+};
+
+static const YuvCoefficients bt601Coefficients = { 9337, 3233, 4756, 16647 };   // 1.13983, 0.39465, 0.58060, 2.03211
+static const YuvCoefficients bt709Coefficients = { 10488, 1760, 3118, 17432 };  // 1.28033, 0.21482, 0.38059, 2.12798
+
+static inline const YuvCoefficients &yuvCoefficients(QDDSHandler::YuvMatrix matrix)
+{
+    return matrix == QDDSHandler::YuvMatrixBt709 ? bt709Coefficients : bt601Coefficients;
+}
+
+// Handler settings that change how a layer is decoded
+struct DecodeOptions
+{
+    DecodeOptions() :
+        yuvMatrix(QDDSHandler::YuvMatrixBt601),
+        expandPalette(false)
+    {}
+
+    QDDSHandler::YuvMatrix yuvMatrix;
+    bool expandPalette;
+};
+
+static DecodeOptions decodeOptions(const QDDSHandler &handler)
+{
+    DecodeOptions options;
+    options.yuvMatrix = handler.yuvMatrix();
+    options.expandPalette = handler.isPaletteExpansionEnabled();
+    return options;
+}
+
+// Rounds to nearest and saturates
+static inline QRgb yuv2rgb(quint8 Y, quint8 U, quint8 V, const YuvCoefficients &k = bt601Coefficients)
 {
-    return qRgb(quint8(Y + 1.13983 * (V - 128)),
-                quint8(Y - 0.39465 * (U - 128) - 0.58060 * (V - 128)),
-                quint8(Y + 2.03211 * (U - 128)));
+    const int y = (Y << 13) + (1 << 12);
+    const int u = U - 128;
+    const int v = V - 128;
+    return qRgb(qBound(0, (y + k.rv * v) >> 13, 255),
+                qBound(0, (y - k.gu * u - k.gv * v) >> 13, 255),
+                qBound(0, (y + k.bu * u) >> 13, 255));
 }
 
 static Format getFormat(const DDSHeader &dds)
@@ -350,6 +420,26 @@ static inline quint8 getNormalZ(quint8 nx, quint8 ny)
     return fxfy > 0 ? 255 * std::sqrt(fxfy) : 0;
 }
 
+// getNormalZ() for every pair of components, shared by ATI2 and CxV8U8
+struct NormalZTable
+{
+    NormalZTable()
+    {
+        for (int x = 0; x < 256; x++) {
+            for (int y = 0; y < 256; y++)
+                z[x][y] = getNormalZ(x, y);
+        }
+    }
+
+    quint8 z[256][256];
+};
+
+static const NormalZTable &normalZTable()
+{
+    static const NormalZTable table;
+    return table;
+}
+
 static inline void decodeColor(quint16 color, quint8 &red, quint8 &green, quint8 &blue)
 {
     red = ((color >> 11) & 0x1f) << 3;
@@ -357,53 +447,293 @@ static inline void decodeColor(quint16 color, quint8 &red, quint8 &green, quint8
     blue = (color & 0x1f) << 3;
 }
 
+// Integer versions of 2/3 c0 + 1/3 c1 and friends. They give the same
+// results as the floating point formulas for all 8-bit inputs.
 static inline quint8 calcC2(quint8 c0, quint8 c1)
 {
-    return 2.0 * c0 / 3.0 + c1 / 3.0;
+    return (2 * c0 + c1) / 3;
 }
 
 static inline quint8 calcC2a(quint8 c0, quint8 c1)
 {
-    return c0 / 2.0 + c1 / 2.0;
+    return (c0 + c1) / 2;
 }
 
 static inline quint8 calcC3(quint8 c0, quint8 c1)
 {
-    return c0 / 3.0 + 2.0 * c1 / 3.0;
+    return (c0 + 2 * c1) / 3;
 }
 
-static void DXTFillColors(QRgb *result, quint16 c0, quint16 c1, quint32 table, bool dxt1a = false)
+static inline void DXTPalette(QRgb *palette, quint16 c0, quint16 c1, bool dxt1a)
 {
-    quint8 r[4];
-    quint8 g[4];
-    quint8 b[4];
-    quint8 a[4];
-
-    a[0] = a[1] = a[2] = a[3] = 255;
+    quint8 r0, g0, b0;
+    quint8 r1, g1, b1;
+    decodeColor(c0, r0, g0, b0);
+    decodeColor(c1, r1, g1, b1);
 
-    decodeColor(c0, r[0], g[0], b[0]);
-    decodeColor(c1, r[1], g[1], b[1]);
+    palette[0] = qRgb(r0, g0, b0);
+    palette[1] = qRgb(r1, g1, b1);
     if (!dxt1a) {
-        r[2] = calcC2(r[0], r[1]);
-        g[2] = calcC2(g[0], g[1]);
-        b[2] = calcC2(b[0], b[1]);
-        r[3] = calcC3(r[0], r[1]);
-        g[3] = calcC3(g[0], g[1]);
-        b[3] = calcC3(b[0], b[1]);
+        palette[2] = qRgb(calcC2(r0, r1), calcC2(g0, g1), calcC2(b0, b1));
+        palette[3] = qRgb(calcC3(r0, r1), calcC3(g0, g1), calcC3(b0, b1));
     } else {
-        r[2] = calcC2a(r[0], r[1]);
-        g[2] = calcC2a(g[0], g[1]);
-        b[2] = calcC2a(b[0], b[1]);
-        r[3] = g[3] = b[3] = a[3] = 0;
+        palette[2] = qRgb(calcC2a(r0, r1), calcC2a(g0, g1), calcC2a(b0, b1));
+        palette[3] = qRgba(0, 0, 0, 0);
+    }
+}
+
+static void DXTFillColors(QRgb *result, quint16 c0, quint16 c1, quint32 table, bool dxt1a = false)
+{
+    QRgb palette[4];
+    DXTPalette(palette, c0, c1, dxt1a);
+
+    for (int i = 0; i < 16; i++) {
+        result[i] = palette[table & 0x0003];
+        table >>= 2;
+    }
+}
+
+static inline void BC1Palette(QRgb *palette, const uchar *block)
+{
+    const quint16 c0 = qFromLittleEndian<quint16>(block);
+    const quint16 c1 = qFromLittleEndian<quint16>(block + 2);
+    DXTPalette(palette, c0, c1, c0 <= c1);
+}
+
+// Decodes a row of complete blocks into the first rows lines
+typedef void (*DXTRowDecoder)(const uchar *src, QRgb *const *lines, quint32 rows, quint32 blocks);
+
+static void decodeBC1Row(const uchar *src, QRgb *const *lines, quint32 rows, quint32 blocks)
+{
+    for (quint32 b = 0; b < blocks; b++, src += 8) {
+        QRgb palette[4];
+        BC1Palette(palette, src);
+        for (quint32 k = 0; k < rows; k++) {
+            quint8 indices = src[4 + k];
+            QRgb *line = lines[k] + 4 * b;
+            for (int l = 0; l < 4; l++) {
+                line[l] = palette[indices & 0x03];
+                indices >>= 2;
+            }
+        }
+    }
+}
+
+enum CpuFeature {
+    CpuSSSE3 = 0x1,
+    CpuAVX2 = 0x2,
+    CpuSSE2 = 0x4,
+    CpuF16C = 0x8
+};
+
+// Set QT_DDS_DISABLE_SIMD to compare the vector kernels with the plain ones
+static uint detectCpuFeatures()
+{
+    uint features = 0;
+#ifdef DDS_X86_DISPATCH
+    if (qEnvironmentVariableIsSet("QT_DDS_DISABLE_SIMD"))
+        return 0;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        features |= CpuSSSE3;
+    if (__builtin_cpu_supports("avx2"))
+        features |= CpuAVX2;
+    if (__builtin_cpu_supports("sse2"))
+        features |= CpuSSE2;
+
+    // F16C is VEX encoded and needs the AVX state saved by the OS
+    unsigned int eax, ebx, ecx, edx;
+    if (__builtin_cpu_supports("avx") && __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C))
+        features |= CpuF16C;
+#endif
+    return features;
+}
+
+static uint cpuFeatures()
+{
+    static const uint features = detectCpuFeatures();
+    return features;
+}
+
+#ifdef DDS_X86_DISPATCH
+// pshufb masks that pick the palette entries for one row of a BC1 block,
+// indexed by the row's byte of the index table
+struct BC1ShuffleMasks
+{
+    BC1ShuffleMasks()
+    {
+        for (int row = 0; row < 256; row++) {
+            for (int l = 0; l < 4; l++) {
+                const int index = (row >> (2 * l)) & 0x03;
+                for (int c = 0; c < 4; c++)
+                    masks[row][4 * l + c] = quint8(4 * index + c);
+            }
+        }
+    }
+
+    quint8 masks[256][16];
+};
+
+static const BC1ShuffleMasks &bc1ShuffleMasks()
+{
+    static const BC1ShuffleMasks masks;
+    return masks;
+}
+
+// Computes the palettes of two blocks at once, with the 16-bit channels of
+// each block's colours in B, G, R, A order. (2 * c0 + c1) / 3 and
+// (c0 + 2 * c1) / 3 are evaluated as a multiply by 0xAAAB and a shift by
+// 17, which is exact for all sums that can occur here.
+DDS_TARGET("ssse3")
+static inline void BC1PalettesSSSE3(__m128i blocks, __m128i &paletteA, __m128i &paletteB,
+                                    bool alwaysFourColors = false)
+{
+    const __m128i endpoint0 = _mm_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 8, 9, 8, 9, 8, 9, 8, 9);
+    const __m128i endpoint1 = _mm_setr_epi8(2, 3, 2, 3, 2, 3, 2, 3, 10, 11, 10, 11, 10, 11, 10, 11);
+    const __m128i shiftLeft = _mm_setr_epi16(8, 0, 0, 0, 8, 0, 0, 0);
+    const __m128i shiftRight = _mm_setr_epi16(0, 1 << 13, 1 << 8, 0, 0, 1 << 13, 1 << 8, 0);
+    const __m128i channelMask = _mm_setr_epi16(0xf8, 0xfc, 0xf8, 0, 0xf8, 0xfc, 0xf8, 0);
+    const __m128i alpha = _mm_setr_epi16(0, 0, 0, 0xff, 0, 0, 0, 0xff);
+    const __m128i sign = _mm_set1_epi16(short(0x8000));
+    const __m128i third = _mm_set1_epi16(short(0xaaab));
+
+    const __m128i e0 = _mm_shuffle_epi8(blocks, endpoint0);
+    const __m128i e1 = _mm_shuffle_epi8(blocks, endpoint1);
+
+    // 565 to 888 without replicating the high bits, like decodeColor()
+    __m128i p0 = _mm_or_si128(_mm_mullo_epi16(e0, shiftLeft), _mm_mulhi_epu16(e0, shiftRight));
+    __m128i p1 = _mm_or_si128(_mm_mullo_epi16(e1, shiftLeft), _mm_mulhi_epu16(e1, shiftRight));
+    p0 = _mm_or_si128(_mm_and_si128(p0, channelMask), alpha);
+    p1 = _mm_or_si128(_mm_and_si128(p1, channelMask), alpha);
+
+    const __m128i fourColors = alwaysFourColors ? _mm_set1_epi16(-1)
+            : _mm_cmpgt_epi16(_mm_xor_si128(e0, sign), _mm_xor_si128(e1, sign));
+    const __m128i c2 = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(p0, p0), p1), third), 1);
+    const __m128i c3 = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(p1, p1), p0), third), 1);
+    const __m128i c2a = _mm_srli_epi16(_mm_add_epi16(p0, p1), 1);
+
+    const __m128i first = _mm_packus_epi16(p0, p1);
+    const __m128i second = _mm_packus_epi16(_mm_or_si128(_mm_and_si128(fourColors, c2), _mm_andnot_si128(fourColors, c2a)),
+                                            _mm_and_si128(fourColors, c3));
+    const __m128i x = _mm_shuffle_epi32(first, _MM_SHUFFLE(3, 1, 2, 0));
+    const __m128i y = _mm_shuffle_epi32(second, _MM_SHUFFLE(3, 1, 2, 0));
+    paletteA = _mm_unpacklo_epi64(x, y);
+    paletteB = _mm_unpackhi_epi64(x, y);
+}
+
+// Same as BC1PalettesSSSE3(), for blocks 0 and 2 in paletteA and blocks 1
+// and 3 in paletteB
+DDS_TARGET("avx2")
+static inline void BC1PalettesAVX2(const uchar *src, __m256i &paletteA, __m256i &paletteB)
+{
+    const __m256i endpoint0 = _mm256_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 8, 9, 8, 9, 8, 9, 8, 9,
+                                               0, 1, 0, 1, 0, 1, 0, 1, 8, 9, 8, 9, 8, 9, 8, 9);
+    const __m256i endpoint1 = _mm256_setr_epi8(2, 3, 2, 3, 2, 3, 2, 3, 10, 11, 10, 11, 10, 11, 10, 11,
+                                               2, 3, 2, 3, 2, 3, 2, 3, 10, 11, 10, 11, 10, 11, 10, 11);
+    const __m256i shiftLeft = _mm256_setr_epi16(8, 0, 0, 0, 8, 0, 0, 0, 8, 0, 0, 0, 8, 0, 0, 0);
+    const __m256i shiftRight = _mm256_setr_epi16(0, 1 << 13, 1 << 8, 0, 0, 1 << 13, 1 << 8, 0,
+                                                 0, 1 << 13, 1 << 8, 0, 0, 1 << 13, 1 << 8, 0);
+    const __m256i channelMask = _mm256_setr_epi16(0xf8, 0xfc, 0xf8, 0, 0xf8, 0xfc, 0xf8, 0,
+                                                  0xf8, 0xfc, 0xf8, 0, 0xf8, 0xfc, 0xf8, 0);
+    const __m256i alpha = _mm256_setr_epi16(0, 0, 0, 0xff, 0, 0, 0, 0xff, 0, 0, 0, 0xff, 0, 0, 0, 0xff);
+    const __m256i sign = _mm256_set1_epi16(short(0x8000));
+    const __m256i third = _mm256_set1_epi16(short(0xaaab));
+
+    const __m256i blocks = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+    const __m256i e0 = _mm256_shuffle_epi8(blocks, endpoint0);
+    const __m256i e1 = _mm256_shuffle_epi8(blocks, endpoint1);
+
+    __m256i p0 = _mm256_or_si256(_mm256_mullo_epi16(e0, shiftLeft), _mm256_mulhi_epu16(e0, shiftRight));
+    __m256i p1 = _mm256_or_si256(_mm256_mullo_epi16(e1, shiftLeft), _mm256_mulhi_epu16(e1, shiftRight));
+    p0 = _mm256_or_si256(_mm256_and_si256(p0, channelMask), alpha);
+    p1 = _mm256_or_si256(_mm256_and_si256(p1, channelMask), alpha);
+
+    const __m256i fourColors = _mm256_cmpgt_epi16(_mm256_xor_si256(e0, sign), _mm256_xor_si256(e1, sign));
+    const __m256i c2 = _mm256_srli_epi16(_mm256_mulhi_epu16(_mm256_add_epi16(_mm256_add_epi16(p0, p0), p1), third), 1);
+    const __m256i c3 = _mm256_srli_epi16(_mm256_mulhi_epu16(_mm256_add_epi16(_mm256_add_epi16(p1, p1), p0), third), 1);
+    const __m256i c2a = _mm256_srli_epi16(_mm256_add_epi16(p0, p1), 1);
+
+    const __m256i first = _mm256_packus_epi16(p0, p1);
+    const __m256i second = _mm256_packus_epi16(_mm256_or_si256(_mm256_and_si256(fourColors, c2), _mm256_andnot_si256(fourColors, c2a)),
+                                               _mm256_and_si256(fourColors, c3));
+    const __m256i x = _mm256_shuffle_epi32(first, _MM_SHUFFLE(3, 1, 2, 0));
+    const __m256i y = _mm256_shuffle_epi32(second, _MM_SHUFFLE(3, 1, 2, 0));
+    paletteA = _mm256_unpacklo_epi64(x, y);
+    paletteB = _mm256_unpackhi_epi64(x, y);
+}
+
+DDS_TARGET("ssse3")
+static void decodeBC1RowSSSE3(const uchar *src, QRgb *const *lines, quint32 rows, quint32 blocks)
+{
+    const BC1ShuffleMasks &shuffle = bc1ShuffleMasks();
+    quint32 b = 0;
+    for (; b + 2 <= blocks; b += 2, src += 16) {
+        __m128i paletteA;
+        __m128i paletteB;
+        BC1PalettesSSSE3(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), paletteA, paletteB);
+        for (quint32 k = 0; k < rows; k++) {
+            const __m128i maskA = _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.masks[src[4 + k]]));
+            const __m128i maskB = _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.masks[src[12 + k]]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(lines[k] + 4 * b), _mm_shuffle_epi8(paletteA, maskA));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(lines[k] + 4 * b + 4), _mm_shuffle_epi8(paletteB, maskB));
+        }
     }
 
-    for (int k = 0; k < 4; k++)
-        for (int l = 0; l < 4; l++) {
-            unsigned index = table & 0x0003;
-            table >>= 2;
+    if (b < blocks) {
+        QRgb palette[4];
+        BC1Palette(palette, src);
+        const __m128i colors = _mm_loadu_si128(reinterpret_cast<const __m128i *>(palette));
+        for (quint32 k = 0; k < rows; k++) {
+            const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.masks[src[4 + k]]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(lines[k] + 4 * b), _mm_shuffle_epi8(colors, mask));
+        }
+    }
+}
 
-            result[k * 4 + l] = qRgba(r[index], g[index], b[index], a[index]);
+// Four blocks at a time, the 128-bit lanes work like the SSSE3 version
+DDS_TARGET("avx2")
+static void decodeBC1RowAVX2(const uchar *src, QRgb *const *lines, quint32 rows, quint32 blocks)
+{
+    const BC1ShuffleMasks &shuffle = bc1ShuffleMasks();
+    quint32 b = 0;
+    for (; b + 4 <= blocks; b += 4, src += 32) {
+        __m256i paletteA;
+        __m256i paletteB;
+        BC1PalettesAVX2(src, paletteA, paletteB);
+        // paletteA holds blocks 0 and 2, paletteB blocks 1 and 3
+        const __m256i colors01 = _mm256_permute2x128_si256(paletteA, paletteB, 0x20);
+        const __m256i colors23 = _mm256_permute2x128_si256(paletteA, paletteB, 0x31);
+        for (quint32 k = 0; k < rows; k++) {
+            const __m256i mask01 = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.masks[src[4 + k]]))),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.masks[src[12 + k]])), 1);
+            const __m256i mask23 = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.masks[src[20 + k]]))),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.masks[src[28 + k]])), 1);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(lines[k] + 4 * b), _mm256_shuffle_epi8(colors01, mask01));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(lines[k] + 4 * b + 8), _mm256_shuffle_epi8(colors23, mask23));
         }
+    }
+
+    if (b < blocks) {
+        QRgb *rest[4];
+        for (quint32 k = 0; k < rows; k++)
+            rest[k] = lines[k] + 4 * b;
+        decodeBC1RowSSSE3(src, rest, rows, blocks - b);
+    }
+}
+#endif // DDS_X86_DISPATCH
+
+static DXTRowDecoder selectBC1RowDecoder()
+{
+#ifdef DDS_X86_DISPATCH
+    if (cpuFeatures() & CpuAVX2)
+        return decodeBC1RowAVX2;
+    if (cpuFeatures() & CpuSSSE3)
+        return decodeBC1RowSSSE3;
+#endif
+    return decodeBC1Row;
 }
 
 template <DXTVersions version>
@@ -421,11 +751,8 @@ inline void setAlphaDXT32Helper(QRgb *rgbArr, quint64 alphas)
     }
 }
 
-template <DXTVersions version>
-inline void setAlphaDXT45Helper(QRgb *rgbArr, quint64 alphas)
+static inline void BC3AlphaPalette(quint8 *a, quint64 alphas)
 {
-    Q_STATIC_ASSERT(version == Four || version == Five);
-    quint8 a[8];
     a[0] = alphas & 0xff;
     a[1] = (alphas >> 8) & 0xff;
     if (a[0] > a[1]) {
@@ -443,6 +770,14 @@ inline void setAlphaDXT45Helper(QRgb *rgbArr, quint64 alphas)
         a[6] = 0;
         a[7] = 255;
     }
+}
+
+template <DXTVersions version>
+inline void setAlphaDXT45Helper(QRgb *rgbArr, quint64 alphas)
+{
+    Q_STATIC_ASSERT(version == Four || version == Five);
+    quint8 a[8];
+    BC3AlphaPalette(a, alphas);
     alphas >>= 16;
     for (int i = 0; i < 16; i++) {
         quint8 index = alphas & 0x07;
@@ -493,786 +828,1777 @@ inline void setAlphaDXT<RXGB>(QRgb *rgbArr, quint64 alphas)
     setAlphaDXT45Helper<Five>(rgbArr, alphas);
 }
 
-static inline QRgb invertRXGBColors(QRgb pixel)
+// Decoding in place needs the right size and format and a buffer that
+// isn't shared
+static bool canDecodeInto(const QImage *target, quint32 width, quint32 height, QImage::Format format)
 {
-    return qRgb(qAlpha(pixel), qGreen(pixel), qBlue(pixel));
+    return target && !target->isNull() && target->width() == int(width) && target->height() == int(height)
+            && target->format() == format && target->isDetached();
 }
 
-template <DXTVersions version>
-static QImage readDXT(QDataStream &s, quint32 width, quint32 height)
+// Hands out target for decoding in place when possible, otherwise
+// allocates a new image
+static QImage createImage(QImage *target, quint32 width, quint32 height, QImage::Format format)
 {
-    QImage::Format format = (version == Two || version == Four) ?
-                QImage::Format_ARGB32_Premultiplied : QImage::Format_ARGB32;
-
-    QImage image(width, height, format);
-
-    for (quint32 i = 0; i < height; i += 4) {
-        for (quint32 j = 0; j < width; j += 4) {
-            quint64 alpha = 0;
-            quint16 c0, c1;
-            quint32 table;
-            if (version != One)
-                s >> alpha;
-            s >> c0;
-            s >> c1;
-            s >> table;
-
-            QRgb arr[16];
+    QImage image;
+    if (canDecodeInto(target, width, height, format)) {
+        image.swap(*target);
+        return image;
+    }
 
-            DXTFillColors(arr, c0, c1, table, version == One && c0 <= c1);
-            setAlphaDXT<version>(arr, alpha);
+    return QImage(width, height, format);
+}
 
-            const quint32 kMax = qMin<quint32>(4, height - i);
-            const quint32 lMax = qMin<quint32>(4, width - j);
-            for (quint32 k = 0; k < kMax; k++) {
-                QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(i + k));
-                for (quint32 l = 0; l < lMax; l++) {
-                    QRgb pixel = arr[k * 4 + l];
-                    if (version == RXGB)
-                        pixel = invertRXGBColors(pixel);
+static inline QRgb invertRXGBColors(QRgb pixel)
+{
+    return qRgb(qAlpha(pixel), qGreen(pixel), qBlue(pixel));
+}
 
-                    line[j + l] = pixel;
-                }
+template <DXTVersions version>
+static void decodeDXTRow(const uchar *src, QRgb *const *lines, quint32 rows, quint32 blocks)
+{
+    for (quint32 b = 0; b < blocks; b++, src += 16) {
+        const quint64 alpha = qFromLittleEndian<quint64>(src);
+        const quint16 c0 = qFromLittleEndian<quint16>(src + 8);
+        const quint16 c1 = qFromLittleEndian<quint16>(src + 10);
+        const quint32 table = qFromLittleEndian<quint32>(src + 12);
+
+        QRgb arr[16];
+        DXTFillColors(arr, c0, c1, table);
+        setAlphaDXT<version>(arr, alpha);
+
+        for (quint32 k = 0; k < rows; k++) {
+            QRgb *line = lines[k] + 4 * b;
+            for (int l = 0; l < 4; l++) {
+                QRgb pixel = arr[k * 4 + l];
+                if (version == RXGB)
+                    pixel = invertRXGBColors(pixel);
+
+                line[l] = pixel;
             }
         }
     }
-    return image;
 }
 
-static inline QImage readDXT1(QDataStream &s, quint32 width, quint32 height)
+#ifdef DDS_X86_DISPATCH
+// Explicit 4-bit alpha of two BC2 blocks, one byte per pixel
+DDS_TARGET("ssse3")
+static inline void BC2AlphaSSSE3(__m128i blocks, __m128i &alphaA, __m128i &alphaB)
 {
-    return readDXT<One>(s, width, height);
+    const __m128i low = _mm_slli_epi16(_mm_and_si128(blocks, _mm_set1_epi8(0x0f)), 4);
+    const __m128i high = _mm_and_si128(blocks, _mm_set1_epi8(char(0xf0)));
+    alphaA = _mm_unpacklo_epi8(low, high);
+    alphaB = _mm_unpackhi_epi8(low, high);
 }
 
-static inline QImage readDXT2(QDataStream &s, quint32 width, quint32 height)
+// The eight alpha values of a BC3 block from its endpoints in 16-bit lanes.
+// The divisions by 7 and 5 are multiplies by 0x2493 and 0x3334 keeping the
+// upper half, which is exact for all sums that can occur here.
+DDS_TARGET("ssse3")
+static inline __m128i BC3AlphaPaletteSSSE3(__m128i a0, __m128i a1)
 {
-    return readDXT<Two>(s, width, height);
+    const __m128i sevenths = _mm_mulhi_epu16(_mm_add_epi16(
+            _mm_mullo_epi16(a0, _mm_setr_epi16(7, 0, 6, 5, 4, 3, 2, 1)),
+            _mm_mullo_epi16(a1, _mm_setr_epi16(0, 7, 1, 2, 3, 4, 5, 6))), _mm_set1_epi16(0x2493));
+    const __m128i fifths = _mm_or_si128(_mm_mulhi_epu16(_mm_add_epi16(
+            _mm_mullo_epi16(a0, _mm_setr_epi16(5, 0, 4, 3, 2, 1, 0, 0)),
+            _mm_mullo_epi16(a1, _mm_setr_epi16(0, 5, 1, 2, 3, 4, 0, 0))), _mm_set1_epi16(0x3334)),
+            _mm_setr_epi16(0, 0, 0, 0, 0, 0, 0, 0xff));
+    const __m128i eightValues = _mm_cmpgt_epi16(a0, a1);
+    return _mm_or_si128(_mm_and_si128(eightValues, sevenths), _mm_andnot_si128(eightValues, fifths));
 }
 
-static inline QImage readDXT3(QDataStream &s, quint32 width, quint32 height)
+// 3-bit indices of one BC3 block, each 16-bit lane holds the two bytes its
+// index can span and is shifted into place with a multiply
+DDS_TARGET("ssse3")
+static inline __m128i BC3IndicesSSSE3(__m128i blocks, __m128i low, __m128i high)
 {
-    return readDXT<Three>(s, width, height);
+    const __m128i shifts = _mm_setr_epi16(256, 32, 4, 128, 16, 2, 64, 8);
+    const __m128i indexMask = _mm_set1_epi16(7);
+    const __m128i first = _mm_mullo_epi16(_mm_shuffle_epi8(blocks, low), shifts);
+    const __m128i second = _mm_mullo_epi16(_mm_shuffle_epi8(blocks, high), shifts);
+    return _mm_packus_epi16(_mm_and_si128(_mm_srli_epi16(first, 8), indexMask),
+                            _mm_and_si128(_mm_srli_epi16(second, 8), indexMask));
 }
 
-static inline QImage readDXT4(QDataStream &s, quint32 width, quint32 height)
+// Interpolated 3-bit alpha of two BC3 blocks, one byte per pixel
+DDS_TARGET("ssse3")
+static inline void BC3AlphaSSSE3(__m128i blocks, __m128i &alphaA, __m128i &alphaB)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i a0A = _mm_unpacklo_epi8(_mm_shuffle_epi8(blocks, _mm_set1_epi8(0)), zero);
+    const __m128i a1A = _mm_unpacklo_epi8(_mm_shuffle_epi8(blocks, _mm_set1_epi8(1)), zero);
+    const __m128i a0B = _mm_unpacklo_epi8(_mm_shuffle_epi8(blocks, _mm_set1_epi8(8)), zero);
+    const __m128i a1B = _mm_unpacklo_epi8(_mm_shuffle_epi8(blocks, _mm_set1_epi8(9)), zero);
+    const __m128i palettes = _mm_packus_epi16(BC3AlphaPaletteSSSE3(a0A, a1A), BC3AlphaPaletteSSSE3(a0B, a1B));
+
+    const __m128i indicesA = BC3IndicesSSSE3(blocks,
+            _mm_setr_epi8(2, 3, 2, 3, 2, 3, 3, 4, 3, 4, 3, 4, 4, 5, 4, 5),
+            _mm_setr_epi8(5, 6, 5, 6, 5, 6, 6, 7, 6, 7, 6, 7, 7, -1, 7, -1));
+    const __m128i indicesB = BC3IndicesSSSE3(blocks,
+            _mm_setr_epi8(10, 11, 10, 11, 10, 11, 11, 12, 11, 12, 11, 12, 12, 13, 12, 13),
+            _mm_setr_epi8(13, 14, 13, 14, 13, 14, 14, 15, 14, 15, 14, 15, 15, -1, 15, -1));
+
+    alphaA = _mm_shuffle_epi8(palettes, indicesA);
+    alphaB = _mm_shuffle_epi8(palettes, _mm_add_epi8(indicesB, _mm_set1_epi8(8)));
+}
+
+// Merges the alpha bytes of a block into one row of its opaque colours.
+// Shuffle entries of 0x80 stay past 0x80 when the row offset is added, so
+// they keep producing zeros. DXT2 and DXT4 premultiply, (x + 1 + (x >> 8)) >> 8
+// equals x / 255 for every product of two bytes.
+template <DXTVersions version>
+DDS_TARGET("ssse3")
+static inline __m128i BC3RowSSSE3(__m128i colors, __m128i alphas, __m128i rowOffset)
 {
-    return readDXT<Four>(s, width, height);
+    if (version == Two || version == Four) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi16(1);
+        const __m128i spread = _mm_shuffle_epi8(alphas, _mm_add_epi8(rowOffset,
+                _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3)));
+        __m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(colors, zero), _mm_unpacklo_epi8(spread, zero));
+        __m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(colors, zero), _mm_unpackhi_epi8(spread, zero));
+        low = _mm_srli_epi16(_mm_add_epi16(low, _mm_add_epi16(_mm_srli_epi16(low, 8), one)), 8);
+        high = _mm_srli_epi16(_mm_add_epi16(high, _mm_add_epi16(_mm_srli_epi16(high, 8), one)), 8);
+        return _mm_packus_epi16(low, high);
+    } else if (version == RXGB) {
+        // The alpha block holds red, the pixels stay opaque
+        const __m128i red = _mm_shuffle_epi8(alphas, _mm_add_epi8(rowOffset,
+                _mm_setr_epi8(-128, -128, 0, -128, -128, -128, 1, -128, -128, -128, 2, -128, -128, -128, 3, -128)));
+        return _mm_or_si128(_mm_and_si128(colors, _mm_set1_epi32(int(0xff00ffff))), red);
+    }
+
+    const __m128i alpha = _mm_shuffle_epi8(alphas, _mm_add_epi8(rowOffset,
+            _mm_setr_epi8(-128, -128, -128, 0, -128, -128, -128, 1, -128, -128, -128, 2, -128, -128, -128, 3)));
+    return _mm_or_si128(_mm_and_si128(colors, _mm_set1_epi32(0x00ffffff)), alpha);
 }
 
-static inline QImage readDXT5(QDataStream &s, quint32 width, quint32 height)
+// Two blocks at a time, each 16-byte block is loaded once for both its alpha
+// and its colour half
+template <DXTVersions version>
+DDS_TARGET("ssse3")
+static void decodeDXTRowSSSE3(const uchar *src, QRgb *const *lines, quint32 rows, quint32 blocks)
 {
-    return readDXT<Five>(s, width, height);
+    const BC1ShuffleMasks &shuffle = bc1ShuffleMasks();
+    quint32 b = 0;
+    for (; b + 2 <= blocks; b += 2, src += 32) {
+        const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+
+        __m128i colorsA;
+        __m128i colorsB;
+        BC1PalettesSSSE3(_mm_unpackhi_epi64(first, second), colorsA, colorsB, true);
+
+        __m128i alphaA;
+        __m128i alphaB;
+        if (version == Two || version == Three)
+            BC2AlphaSSSE3(_mm_unpacklo_epi64(first, second), alphaA, alphaB);
+        else
+            BC3AlphaSSSE3(_mm_unpacklo_epi64(first, second), alphaA, alphaB);
+
+        __m128i rowOffset = _mm_setzero_si128();
+        for (quint32 k = 0; k < rows; k++) {
+            const __m128i maskA = _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.masks[src[12 + k]]));
+            const __m128i maskB = _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle.masks[src[28 + k]]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(lines[k] + 4 * b),
+                             BC3RowSSSE3<version>(_mm_shuffle_epi8(colorsA, maskA), alphaA, rowOffset));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(lines[k] + 4 * b + 4),
+                             BC3RowSSSE3<version>(_mm_shuffle_epi8(colorsB, maskB), alphaB, rowOffset));
+            rowOffset = _mm_add_epi8(rowOffset, _mm_set1_epi8(4));
+        }
+    }
+
+    if (b < blocks) {
+        QRgb *rest[4];
+        for (quint32 k = 0; k < rows; k++)
+            rest[k] = lines[k] + 4 * b;
+        decodeDXTRow<version>(src, rest, rows, blocks - b);
+    }
 }
+#endif // DDS_X86_DISPATCH
 
-static inline QImage readRXGB(QDataStream &s, quint32 width, quint32 height)
+template <DXTVersions version>
+static DXTRowDecoder selectDXTRowDecoder()
 {
-    return readDXT<RXGB>(s, width, height);
+#ifdef DDS_X86_DISPATCH
+    if (cpuFeatures() & CpuSSSE3)
+        return decodeDXTRowSSSE3<version>;
+#endif
+    return decodeDXTRow<version>;
 }
 
-static QImage readATI2(QDataStream &s, quint32 width, quint32 height)
+template <>
+DXTRowDecoder selectDXTRowDecoder<One>()
 {
-    QImage image(width, height, QImage::Format_RGB32);
+    return selectBC1RowDecoder();
+}
 
-    for (quint32 i = 0; i < height; i += 4) {
-        for (quint32 j = 0; j < width; j += 4) {
-            quint64 alpha1;
-            quint64 alpha2;
-            s >> alpha1;
-            s >> alpha2;
+#ifdef DDS_X86_DISPATCH
+// Images that do not fit in the last level cache are written with
+// non-temporal stores, 16 MB is assumed when the size is not known
+static qint64 detectStreamingThreshold()
+{
+    qint64 size = 0;
+#if defined(Q_OS_UNIX) && defined(_SC_LEVEL3_CACHE_SIZE)
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    return size > 0 ? size : qint64(16 * 1024 * 1024);
+}
 
-            QRgb arr[16];
-            memset(arr, 0, sizeof(QRgb) * 16);
-            setAlphaDXT<Five>(arr, alpha1);
-            for (int k = 0; k < 16; ++k) {
-                quint8 a = qAlpha(arr[k]);
-                arr[k] = qRgba(0, 0, a, 0);
-            }
-            setAlphaDXT<Five>(arr, alpha2);
-
-            const quint32 kMax = qMin<quint32>(4, height - i);
-            const quint32 lMax = qMin<quint32>(4, width - j);
-            for (quint32 k = 0; k < kMax; k++) {
-                QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(i + k));
-                for (quint32 l = 0; l < lMax; l++) {
-                    QRgb pixel = arr[k * 4 + l];
-                    const quint8 nx = qAlpha(pixel);
-                    const quint8 ny = qBlue(pixel);
-                    const quint8 nz = getNormalZ(nx, ny);
-                    line[j + l] = qRgb(nx, ny, nz);
-                }
-            }
-        }
-    }
-    return image;
+static qint64 streamingThreshold()
+{
+    static const qint64 threshold = detectStreamingThreshold();
+    return threshold;
 }
 
-static QImage readUnsignedImage(QDataStream &s, const DDSHeader &dds, quint32 width, quint32 height, bool hasAlpha)
+DDS_TARGET("sse2")
+static void streamLine(QRgb *dst, const QRgb *src, quint32 count)
 {
-    quint32 flags = dds.pixelFormat.flags;
+    quint32 x = 0;
+    for (; x < count && (quintptr(dst + x) & 15); x++)
+        dst[x] = src[x];
+    for (; x + 4 <= count; x += 4)
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst + x), _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x)));
+    for (; x < count; x++)
+        dst[x] = src[x];
+}
+#endif
 
-    quint32 masks[ColorCount];
-    quint8 shifts[ColorCount];
-    quint8 bits[ColorCount];
-    masks[Red] = dds.pixelFormat.rBitMask;
-    masks[Green] = dds.pixelFormat.gBitMask;
-    masks[Blue] = dds.pixelFormat.bBitMask;
-    masks[Alpha] = hasAlpha ? dds.pixelFormat.aBitMask : 0;
-    for (int i = 0; i < ColorCount; ++i) {
-        shifts[i] = maskToShift(masks[i]);
-        bits[i] = maskLength(masks[i]);
+// Levels smaller than this are decoded on the calling thread, larger ones
+// are split into ranges of rows for the global thread pool
+static const qint64 parallelThreshold = 1024 * 1024;
 
-        // move mask to the left
-        if (bits[i] <= 8)
-            masks[i] = (masks[i] >> shifts[i]) << (8 - bits[i]);
+// Runs decode() over rows [0, rows) of range, split into one part per pool
+// thread when the output is large enough. Parts start on multiples of align.
+template <typename Range>
+static void decodeRanges(Range range, quint32 rows, quint32 align, qint64 bytes, void (*decode)(Range &))
+{
+    const quint64 units = (rows + align - 1) / align;
+    const quint64 threads = quint64(qMax(1, QThreadPool::globalInstance()->maxThreadCount()));
+    const quint64 count = qMin(threads, units);
+
+    range.first = 0;
+    range.last = rows;
+    if (bytes < parallelThreshold || count < 2) {
+        decode(range);
+        return;
     }
 
-    const QImage::Format format = hasAlpha ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+    QVector<Range> ranges;
+    ranges.reserve(int(count));
+    for (quint64 i = 0; i < count; i++) {
+        range.first = quint32(align * (units * i / count));
+        range.last = quint32(qMin<quint64>(rows, align * (units * (i + 1) / count)));
+        ranges.append(range);
+    }
+    QtConcurrent::blockingMap(ranges, decode);
+}
 
-    QImage image(width, height, format);
+// Block rows [first, last) of an image, in scan lines
+struct BlockRowRange
+{
+    const uchar *src;
+    quint32 blockSize;
+    DXTRowDecoder decodeBlocks;
+    uchar *bits;
+    qint64 bytesPerLine;
+    quint32 width;
+    quint32 first;
+    quint32 last;
+    bool streaming;
+};
 
-    for (quint32 y = 0; y < height; y++) {
-        for (quint32 x = 0; x < width; x++) {
-            QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+// Decodes a range a strip of four scan lines at a time. Large images are
+// decoded into a strip buffer that stays in the cache and then streamed
+// out, small ones go straight into the image.
+static void decodeBlockRows(BlockRowRange &range)
+{
+    const quint32 width = range.width;
+    const quint32 blocks = width / 4;
+    const quint32 blocksPerRow = (width + 3) / 4;
+    const uchar *src = range.src + qint64(range.first / 4) * blocksPerRow * range.blockSize;
+
+    QVector<QRgb> strip(range.streaming ? 4 * width : 0);
+
+    for (quint32 i = range.first; i < range.last; i += 4) {
+        const quint32 kMax = qMin<quint32>(4, range.last - i);
+        QRgb *lines[4];
+        for (quint32 k = 0; k < kMax; k++) {
+            lines[k] = range.streaming ? strip.data() + k * width
+                                       : reinterpret_cast<QRgb *>(range.bits + (i + k) * range.bytesPerLine);
+        }
 
-            quint32 value = readValue(s, dds.pixelFormat.rgbBitCount);
-            quint8 colors[ColorCount];
+        range.decodeBlocks(src, lines, kMax, blocks);
+        src += range.blockSize * blocks;
 
-            for (int c = 0; c < ColorCount; ++c) {
-                if (bits[c] > 8) {
-                    // truncate unneseccary bits
-                    colors[c] = (value & masks[c]) >> shifts[c] >> (bits[c] - 8);
-                } else {
-                    // move color to the left
-                    quint8 color = value >> shifts[c] << (8 - bits[c]) & masks[c];
-                    if (masks[c])
-                        colors[c] = color * 0xff / masks[c];
-                    else
-                        colors[c] = 0;
-                }
-            }
+        if (4 * blocks < width) {
+            // The partial block at the right edge
+            QRgb arr[16];
+            QRgb *rows[4] = { arr, arr + 4, arr + 8, arr + 12 };
+            range.decodeBlocks(src, rows, kMax, 1);
+            src += range.blockSize;
 
-            if (flags & DDSPixelFormat::FlagLuminance)
-                line[x] = qRgba(colors[Red], colors[Red], colors[Red], colors[Alpha]);
-            else if (flags & DDSPixelFormat::FlagYUV)
-                line[x] = yuv2rgb(colors[Red], colors[Green], colors[Blue]);
-            else
-                line[x] = qRgba(colors[Red], colors[Green], colors[Blue], colors[Alpha]);
+            for (quint32 k = 0; k < kMax; k++)
+                memcpy(lines[k] + 4 * blocks, rows[k], (width - 4 * blocks) * sizeof(QRgb));
         }
+
+#ifdef DDS_X86_DISPATCH
+        if (range.streaming) {
+            for (quint32 k = 0; k < kMax; k++)
+                streamLine(reinterpret_cast<QRgb *>(range.bits + (i + k) * range.bytesPerLine), lines[k], width);
+        }
+#endif
     }
 
-    return image;
+#ifdef DDS_X86_DISPATCH
+    if (range.streaming)
+        _mm_sfence();
+#endif
 }
 
-static double readFloat16(QDataStream &s)
+static void decodeBlockImage(const uchar *src, quint32 blockSize, DXTRowDecoder decodeBlocks, QImage &image)
 {
-    quint16 value;
-    s >> value;
-
-    double sign = (value & 0x8000) == 0x8000 ? -1.0 : 1.0;
-    qint8 exp = (value & 0x7C00) >> 10;
-    quint16 fraction = value & 0x3FF;
-
-    if (exp == 0)
-        return sign * std::pow(2.0, -14.0) * fraction / 1024.0;
-    else
-        return sign * std::pow(2.0, exp - 15) * (1 + fraction / 1024.0);
+    const quint32 height = quint32(image.height());
+    const qint64 bytes = qint64(image.bytesPerLine()) * height;
+
+    BlockRowRange range;
+    range.src = src;
+    range.blockSize = blockSize;
+    range.decodeBlocks = decodeBlocks;
+    range.bits = image.bits();
+    range.bytesPerLine = image.bytesPerLine();
+    range.width = quint32(image.width());
+    range.streaming = false;
+#ifdef DDS_X86_DISPATCH
+    range.streaming = (cpuFeatures() & CpuSSE2) && bytes > streamingThreshold();
+#endif
+
+    decodeRanges(range, height, 4, bytes, decodeBlockRows);
 }
 
-static inline float readFloat32(QDataStream &s)
+template <DXTVersions version>
+static QImage readDXT(const uchar *data, quint32 width, quint32 height, QImage *target)
 {
-    Q_ASSERT(sizeof(float) == 4);
-    float value;
-    // TODO: find better way to avoid setting precision each time
-    QDataStream::FloatingPointPrecision precision = s.floatingPointPrecision();
-    s.setFloatingPointPrecision(QDataStream::SinglePrecision);
-    s >> value;
-    s.setFloatingPointPrecision(precision);
-    return value;
-}
+    QImage::Format format = (version == Two || version == Four) ?
+                QImage::Format_ARGB32_Premultiplied : QImage::Format_ARGB32;
 
-static QImage readR16F(QDataStream &s, const quint32 width, const quint32 height)
-{
-    QImage image(width, height, QImage::Format_RGB32);
+    QImage image = createImage(target, width, height, format);
 
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            quint8 r = readFloat16(s) * 255;
-            line[x] = qRgba(r, 0, 0, 0);
-        }
-    }
+    static const DXTRowDecoder decodeBlocks = selectDXTRowDecoder<version>();
+    decodeBlockImage(data, version == One ? 8 : 16, decodeBlocks, image);
 
     return image;
 }
 
-static QImage readRG16F(QDataStream &s, const quint32 width, const quint32 height)
+static inline QImage readDXT1(const uchar *data, quint32 width, quint32 height, QImage *target)
 {
-    QImage image(width, height, QImage::Format_RGB32);
-
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            quint8 r = readFloat16(s) * 255;
-            quint8 g = readFloat16(s) * 255;
-            line[x] = qRgba(r, g, 0, 0);
-        }
-    }
+    return readDXT<One>(data, width, height, target);
+}
 
-    return image;
+static inline QImage readDXT2(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readDXT<Two>(data, width, height, target);
 }
 
-static QImage readARGB16F(QDataStream &s, const quint32 width, const quint32 height)
+static inline QImage readDXT3(const uchar *data, quint32 width, quint32 height, QImage *target)
 {
-    QImage image(width, height, QImage::Format_ARGB32);
+    return readDXT<Three>(data, width, height, target);
+}
 
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            quint8 colors[ColorCount];
-            for (int c = 0; c < ColorCount; ++c)
-                colors[c] = readFloat16(s) * 255;
+static inline QImage readDXT4(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readDXT<Four>(data, width, height, target);
+}
 
-            line[x] = qRgba(colors[Red], colors[Green], colors[Blue], colors[Alpha]);
-        }
-    }
+static inline QImage readDXT5(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readDXT<Five>(data, width, height, target);
+}
 
-    return image;
+static inline QImage readRXGB(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readDXT<RXGB>(data, width, height, target);
 }
 
-static QImage readR32F(QDataStream &s, const quint32 width, const quint32 height)
+// One BC4 channel block, 8 bytes, to 16 values
+static inline void BC4Values(quint8 *values, const uchar *block)
 {
-    QImage image(width, height, QImage::Format_RGB32);
+    quint64 alphas = qFromLittleEndian<quint64>(block);
+    quint8 a[8];
+    BC3AlphaPalette(a, alphas);
+    alphas >>= 16;
+    for (int i = 0; i < 16; i++) {
+        values[i] = a[alphas & 0x07];
+        alphas >>= 3;
+    }
+}
 
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            quint8 r = readFloat32(s) * 255;
-            line[x] = qRgba(r, 0, 0, 0);
+// ATI2 keeps Y in the first channel block and X in the second, Z is
+// reconstructed from both
+static void decodeBC5Row(const uchar *src, QRgb *const *lines, quint32 rows, quint32 blocks)
+{
+    const NormalZTable &normalZ = normalZTable();
+    for (quint32 b = 0; b < blocks; b++, src += 16) {
+        quint8 ny[16];
+        quint8 nx[16];
+        BC4Values(ny, src);
+        BC4Values(nx, src + 8);
+        for (quint32 k = 0; k < rows; k++) {
+            QRgb *line = lines[k] + 4 * b;
+            for (int l = 0; l < 4; l++) {
+                const quint8 x = nx[4 * k + l];
+                const quint8 y = ny[4 * k + l];
+                line[l] = qRgb(x, y, normalZ.z[x][y]);
+            }
         }
     }
-
-    return image;
 }
 
-static QImage readRG32F(QDataStream &s, const quint32 width, const quint32 height)
+#ifdef DDS_X86_DISPATCH
+// Both channels of a block go through the BC3 alpha decoder at once, only
+// the Z lookups are scalar
+DDS_TARGET("ssse3")
+static void decodeBC5RowSSSE3(const uchar *src, QRgb *const *lines, quint32 rows, quint32 blocks)
 {
-    QImage image(width, height, QImage::Format_RGB32);
-
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            quint8 r = readFloat32(s) * 255;
-            quint8 g = readFloat32(s) * 255;
-            line[x] = qRgba(r, g, 0, 0);
-        }
+    const NormalZTable &normalZ = normalZTable();
+    const __m128i opaque = _mm_set1_epi8(char(0xff));
+    for (quint32 b = 0; b < blocks; b++, src += 16) {
+        __m128i ny;
+        __m128i nx;
+        BC3AlphaSSSE3(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), ny, nx);
+
+        quint8 x[16];
+        quint8 y[16];
+        quint8 z[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(x), nx);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(y), ny);
+        for (int i = 0; i < 16; i++)
+            z[i] = normalZ.z[x[i]][y[i]];
+        const __m128i nz = _mm_loadu_si128(reinterpret_cast<const __m128i *>(z));
+
+        // B, G, R, A byte order of QRgb in memory
+        const __m128i zyLow = _mm_unpacklo_epi8(nz, ny);
+        const __m128i zyHigh = _mm_unpackhi_epi8(nz, ny);
+        const __m128i xaLow = _mm_unpacklo_epi8(nx, opaque);
+        const __m128i xaHigh = _mm_unpackhi_epi8(nx, opaque);
+        const __m128i pixels[4] = {
+            _mm_unpacklo_epi16(zyLow, xaLow), _mm_unpackhi_epi16(zyLow, xaLow),
+            _mm_unpacklo_epi16(zyHigh, xaHigh), _mm_unpackhi_epi16(zyHigh, xaHigh)
+        };
+        for (quint32 k = 0; k < rows; k++)
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(lines[k] + 4 * b), pixels[k]);
     }
+}
+#endif // DDS_X86_DISPATCH
 
-    return image;
+static DXTRowDecoder selectBC5RowDecoder()
+{
+#ifdef DDS_X86_DISPATCH
+    if (cpuFeatures() & CpuSSSE3)
+        return decodeBC5RowSSSE3;
+#endif
+    return decodeBC5Row;
 }
 
-static QImage readARGB32F(QDataStream &s, const quint32 width, const quint32 height)
+static QImage readATI2(const uchar *data, quint32 width, quint32 height, QImage *target)
 {
-    QImage image(width, height, QImage::Format_ARGB32);
+    QImage image = createImage(target, width, height, QImage::Format_RGB32);
 
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            quint8 colors[ColorCount];
-            for (int c = 0; c < ColorCount; ++c)
-                colors[c] = readFloat32(s) * 255;
-            line[x] = qRgba(colors[Red], colors[Green], colors[Blue], colors[Alpha]);
-        }
-    }
+    static const DXTRowDecoder decodeBlocks = selectBC5RowDecoder();
+    decodeBlockImage(data, 16, decodeBlocks, image);
 
     return image;
 }
 
-static QImage readQ16W16V16U16(QDataStream &s, const quint32 width, const quint32 height)
+// Expands n-bit channel values the way the generic loop in
+// readUnsignedImage() does, indexed by the bit count
+struct ChannelTables
 {
-    QImage image(width, height, QImage::Format_ARGB32);
-
-    quint8 colors[ColorCount];
-    qint16 tmp;
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            for (int i = 0; i < ColorCount; i++) {
-                s >> tmp;
-                colors[i] = (tmp + 0x7FFF) >> 8;
-            }
-            line[x] = qRgba(colors[Red], colors[Green], colors[Blue], colors[Alpha]);
+    ChannelTables()
+    {
+        for (int bits = 1; bits <= 8; bits++) {
+            const quint32 mask = ((1u << bits) - 1) << (8 - bits);
+            for (quint32 value = 0; value < 256; value++)
+                expand[bits][value] = quint8(((value << (8 - bits)) & mask) * 0xff / mask);
         }
+        memset(expand[0], 0, sizeof(expand[0]));
     }
 
-    return image;
+    quint8 expand[9][256];
+};
+
+static const ChannelTables &channelTables()
+{
+    static const ChannelTables tables;
+    return tables;
 }
 
-static QImage readCxV8U8(QDataStream &s, const quint32 width, const quint32 height)
+// maskToShift() and maskLength() as compile time constants
+template <quint32 mask>
+struct MaskShift
 {
-    QImage image(width, height, QImage::Format_RGB32);
+    enum { value = (mask & 1) ? 0 : 1 + MaskShift<(mask >> 1)>::value };
+};
 
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            qint8 v, u;
-            s >> v >> u;
+template <>
+struct MaskShift<0>
+{
+    enum { value = 0 };
+};
 
-            const quint8 vn = v + 128;
-            const quint8 un = u + 128;
-            const quint8 c = getNormalZ(vn, un);
+template <quint32 mask>
+struct MaskLength
+{
+    enum { value = (mask & 1) + MaskLength<(mask >> 1)>::value };
+};
 
-            line[x] = qRgb(vn, un, c);
-        }
-    }
+template <>
+struct MaskLength<0>
+{
+    enum { value = 0 };
+};
 
-    return image;
+template <quint32 mask>
+static inline quint8 unsignedChannel(quint32 value, const ChannelTables &tables)
+{
+    const int shift = MaskShift<mask>::value;
+    const int bits = MaskLength<mask>::value;
+    if (mask == 0)
+        return 0;
+    if (bits > 8)
+        return (value & mask) >> shift >> (bits - 8);
+    if (bits == 8)
+        return (value & mask) >> shift;
+    return tables.expand[bits][(value & mask) >> shift];
 }
 
-static QImage readPalette8Image(QDataStream &s, quint32 width, quint32 height)
+template <quint32 bitCount>
+static inline quint32 unsignedValue(const uchar *src)
 {
-    QImage image(width, height, QImage::Format_Indexed8);
-    for (int i = 0; i < 256; ++i) {
-        quint8 r, g, b, a;
-        s >> r >> g >> b >> a;
-        image.setColor(i, qRgba(r, g, b, a));
-    }
+    if (bitCount == 32)
+        return qFromLittleEndian<quint32>(src);
+    if (bitCount == 24)
+        return src[0] | (src[1] << 8) | (src[2] << 16);
+    if (bitCount == 16)
+        return qFromLittleEndian<quint16>(src);
+    return src[0];
+}
 
-    for (quint32 y = 0; y < height; y++) {
-        for (quint32 x = 0; x < width; x++) {
-            quint8 index;
-            s >> index;
-            image.setPixel(x, y, index);
+// readUnsignedImage() for one line of a fixed layout
+template <quint32 bitCount, quint32 rMask, quint32 gMask, quint32 bMask, quint32 aMask, bool luminance>
+static void readUnsignedLine(const uchar *src, QRgb *line, quint32 width)
+{
+    if (bitCount == 32 && rMask == 0x00ff0000 && gMask == 0x0000ff00 && bMask == 0x000000ff && !luminance) {
+        // Already QRgb, without an alpha mask the alpha bytes are cleared
+        if (aMask == 0xff000000 && Q_BYTE_ORDER == Q_LITTLE_ENDIAN) {
+            memcpy(line, src, width * sizeof(QRgb));
+        } else {
+            const quint32 keep = aMask ? 0xffffffff : 0x00ffffff;
+            for (quint32 x = 0; x < width; x++)
+                line[x] = qFromLittleEndian<quint32>(src + 4 * x) & keep;
         }
+        return;
     }
 
-    return image;
+    const ChannelTables &tables = channelTables();
+    for (quint32 x = 0; x < width; x++, src += bitCount / 8) {
+        const quint32 value = unsignedValue<bitCount>(src);
+        const quint8 red = unsignedChannel<rMask>(value, tables);
+        const quint8 alpha = unsignedChannel<aMask>(value, tables);
+        if (luminance)
+            line[x] = qRgba(red, red, red, alpha);
+        else
+            line[x] = qRgba(red, unsignedChannel<gMask>(value, tables), unsignedChannel<bMask>(value, tables), alpha);
+    }
 }
 
-static QImage readPalette4Image(QDataStream &s, quint32 width, quint32 height)
+// Scan lines [first, last) of an image whose source lines are pitch bytes
+// apart, with the per-format state the lines are decoded with
+template <typename Context>
+struct LineRange
 {
-    QImage image(width, height, QImage::Format_Indexed8);
-    for (int i = 0; i < 16; ++i) {
-        quint8 r, g, b, a;
-        s >> r >> g >> b >> a;
-        image.setColor(i, qRgba(r, g, b, a));
-    }
+    Context context;
+    const uchar *src;
+    qint64 pitch;
+    uchar *bits;
+    qint64 bytesPerLine;
+    quint32 width;
+    quint32 first;
+    quint32 last;
+
+    const uchar *sourceLine(quint32 y) const { return src + y * pitch; }
+    QRgb *line(quint32 y) const { return reinterpret_cast<QRgb *>(bits + y * bytesPerLine); }
+};
 
-    for (quint32 y = 0; y < height; y++) {
-        quint8 index;
-        for (quint32 x = 0; x < width - 1; ) {
-            s >> index;
-            image.setPixel(x++, y, (index & 0x0f) >> 0);
-            image.setPixel(x++, y, (index & 0xf0) >> 4);
-        }
-        if (width % 2 == 1) {
-            s >> index;
-            image.setPixel(width - 1, y, (index & 0x0f) >> 0);
+// Decodes all lines of image, in parallel for large images. Lines only
+// depend on their own source line so no state is shared between threads.
+template <typename Context>
+static void decodeLines(const uchar *data, qint64 pitch, const Context &context, QImage &image,
+                        void (*decode)(LineRange<Context> &))
+{
+    LineRange<Context> range;
+    range.context = context;
+    range.src = data;
+    range.pitch = pitch;
+    range.bits = image.bits();
+    range.bytesPerLine = image.bytesPerLine();
+    range.width = quint32(image.width());
+
+    const quint32 height = quint32(image.height());
+    decodeRanges(range, height, 1, range.bytesPerLine * height, decode);
+}
+
+typedef void (*LineReader)(const uchar *src, QRgb *line, quint32 width);
+
+static void readLineRange(LineRange<LineReader> &range)
+{
+    for (quint32 y = range.first; y < range.last; y++)
+        range.context(range.sourceLine(y), range.line(y), range.width);
+}
+
+static QImage readLines(const uchar *data, quint32 width, quint32 height, quint32 bytesPerPixel,
+                        QImage::Format format, LineReader readLine, QImage *target)
+{
+    QImage image = createImage(target, width, height, format);
+    decodeLines(data, qint64(width) * bytesPerPixel, readLine, image, readLineRange);
+    return image;
+}
+
+struct UnsignedLayout
+{
+    quint32 bitCount;
+    quint32 rBitMask;
+    quint32 gBitMask;
+    quint32 bBitMask;
+    quint32 aBitMask; // 0 when the format is read without alpha
+    bool luminance;
+    LineReader read;
+};
+
+#define DDS_UNSIGNED_LAYOUT(bitCount, r, g, b, a, luminance) \
+    { bitCount, r, g, b, a, luminance, readUnsignedLine<bitCount, r, g, b, a, luminance> }
+
+// The formatInfos[] entries that readLayer() sends to readUnsignedImage()
+static const UnsignedLayout unsignedLayouts[] = {
+    DDS_UNSIGNED_LAYOUT(32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000, false), // A8R8G8B8
+    DDS_UNSIGNED_LAYOUT(32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0x00000000, false), // X8R8G8B8
+    DDS_UNSIGNED_LAYOUT(32, 0x000003ff, 0x000ffc00, 0x3ff00000, 0xc0000000, false), // A2B10G10R10
+    DDS_UNSIGNED_LAYOUT(32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000, false), // A8B8G8R8
+    DDS_UNSIGNED_LAYOUT(32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0x00000000, false), // X8B8G8R8
+    DDS_UNSIGNED_LAYOUT(32, 0x0000ffff, 0xffff0000, 0x00000000, 0x00000000, false), // G16R16
+    DDS_UNSIGNED_LAYOUT(32, 0x3ff00000, 0x000ffc00, 0x000003ff, 0xc0000000, false), // A2R10G10B10
+    DDS_UNSIGNED_LAYOUT(24, 0x00ff0000, 0x0000ff00, 0x000000ff, 0x00000000, false), // R8G8B8
+    DDS_UNSIGNED_LAYOUT(16, 0x0000f800, 0x000007e0, 0x0000001f, 0x00000000, false), // R5G6B5
+    DDS_UNSIGNED_LAYOUT(16, 0x00007c00, 0x000003e0, 0x0000001f, 0x00000000, false), // X1R5G5B5
+    DDS_UNSIGNED_LAYOUT(16, 0x00007c00, 0x000003e0, 0x0000001f, 0x00008000, false), // A1R5G5B5
+    DDS_UNSIGNED_LAYOUT(16, 0x00000f00, 0x000000f0, 0x0000000f, 0x0000f000, false), // A4R4G4B4
+    DDS_UNSIGNED_LAYOUT(16, 0x000000e0, 0x0000001c, 0x00000003, 0x0000ff00, false), // A8R3G3B2
+    DDS_UNSIGNED_LAYOUT(16, 0x00000f00, 0x000000f0, 0x0000000f, 0x00000000, false), // X4R4G4B4
+    DDS_UNSIGNED_LAYOUT(16, 0x000000ff, 0x00000000, 0x00000000, 0x0000ff00, true),  // A8L8
+    DDS_UNSIGNED_LAYOUT(16, 0x0000ffff, 0x00000000, 0x00000000, 0x00000000, true),  // L16
+    DDS_UNSIGNED_LAYOUT(8,  0x000000e0, 0x0000001c, 0x00000003, 0x00000000, false), // R3G3B2
+    DDS_UNSIGNED_LAYOUT(8,  0x00000000, 0x00000000, 0x00000000, 0x000000ff, false), // A8
+    DDS_UNSIGNED_LAYOUT(8,  0x000000ff, 0x00000000, 0x00000000, 0x00000000, true),  // L8
+    DDS_UNSIGNED_LAYOUT(8,  0x0000000f, 0x00000000, 0x00000000, 0x000000f0, true)   // A4L4
+};
+static const size_t unsignedLayoutsSize = sizeof(unsignedLayouts)/sizeof(UnsignedLayout);
+
+#undef DDS_UNSIGNED_LAYOUT
+
+static LineReader unsignedLineReader(const DDSPixelFormat &format, bool hasAlpha)
+{
+    // YUV and unexpected luminance flags are left to the generic loop
+    if (format.flags & DDSPixelFormat::FlagYUV)
+        return Q_NULLPTR;
+
+    const bool luminance = (format.flags & DDSPixelFormat::FlagLuminance) != 0;
+    const quint32 aBitMask = hasAlpha ? format.aBitMask : 0;
+    for (size_t i = 0; i < unsignedLayoutsSize; ++i) {
+        const UnsignedLayout &layout = unsignedLayouts[i];
+        if (layout.bitCount == format.rgbBitCount &&
+                layout.rBitMask == format.rBitMask &&
+                layout.gBitMask == format.gBitMask &&
+                layout.bBitMask == format.bBitMask &&
+                layout.aBitMask == aBitMask &&
+                layout.luminance == luminance) {
+            return layout.read;
         }
     }
 
-    return image;
+    return Q_NULLPTR;
 }
 
-static QImage readARGB16(QDataStream &s, quint32 width, quint32 height)
+// The layout of a format that has no specialised line reader
+struct UnsignedMasks
 {
-    QImage image(width, height, QImage::Format_ARGB32);
+    quint32 flags;
+    quint32 bitCount;
+    quint32 masks[ColorCount];
+    quint8 shifts[ColorCount];
+    quint8 bits[ColorCount];
+};
 
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
+static void readUnsignedLineRange(LineRange<UnsignedMasks> &range)
+{
+    const UnsignedMasks &f = range.context;
+    const quint32 bytesPerPixel = f.bitCount / 8;
+    for (quint32 y = range.first; y < range.last; y++) {
+        const uchar *src = range.sourceLine(y);
+        QRgb *line = range.line(y);
+        for (quint32 x = 0; x < range.width; x++) {
+            quint32 value = readValue(src, f.bitCount);
+            src += bytesPerPixel;
             quint8 colors[ColorCount];
-            for (int i = 0; i < ColorCount; ++i) {
-                quint16 color;
-                s >> color;
-                colors[i] = quint8(color >> 8);
+
+            for (int c = 0; c < ColorCount; ++c) {
+                if (f.bits[c] > 8) {
+                    // truncate unneseccary bits
+                    colors[c] = (value & f.masks[c]) >> f.shifts[c] >> (f.bits[c] - 8);
+                } else {
+                    // move color to the left
+                    quint8 color = value >> f.shifts[c] << (8 - f.bits[c]) & f.masks[c];
+                    if (f.masks[c])
+                        colors[c] = color * 0xff / f.masks[c];
+                    else
+                        colors[c] = 0;
+                }
             }
-            line[x] = qRgba(colors[Red], colors[Green], colors[Blue], colors[Alpha]);
+
+            if (f.flags & DDSPixelFormat::FlagLuminance)
+                line[x] = qRgba(colors[Red], colors[Red], colors[Red], colors[Alpha]);
+            else if (f.flags & DDSPixelFormat::FlagYUV)
+                line[x] = yuv2rgb(colors[Red], colors[Green], colors[Blue]);
+            else
+                line[x] = qRgba(colors[Red], colors[Green], colors[Blue], colors[Alpha]);
         }
     }
-
-    return image;
 }
 
-static QImage readV8U8(QDataStream &s, quint32 width, quint32 height)
+static QImage readUnsignedImage(const uchar *data, const DDSHeader &dds, quint32 width, quint32 height, bool hasAlpha, QImage *target)
 {
-    QImage image(width, height, QImage::Format_RGB32);
+    const QImage::Format format = hasAlpha ? QImage::Format_ARGB32 : QImage::Format_RGB32;
 
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            qint8 v, u;
-            s >> v >> u;
-            line[x] = qRgb(v + 128, u + 128, 255);
-        }
+    if (LineReader readLine = unsignedLineReader(dds.pixelFormat, hasAlpha))
+        return readLines(data, width, height, dds.pixelFormat.rgbBitCount / 8, format, readLine, target);
+
+    UnsignedMasks masks;
+    masks.flags = dds.pixelFormat.flags;
+    masks.bitCount = dds.pixelFormat.rgbBitCount;
+    masks.masks[Red] = dds.pixelFormat.rBitMask;
+    masks.masks[Green] = dds.pixelFormat.gBitMask;
+    masks.masks[Blue] = dds.pixelFormat.bBitMask;
+    masks.masks[Alpha] = hasAlpha ? dds.pixelFormat.aBitMask : 0;
+    for (int i = 0; i < ColorCount; ++i) {
+        masks.shifts[i] = maskToShift(masks.masks[i]);
+        masks.bits[i] = maskLength(masks.masks[i]);
+
+        // move mask to the left
+        if (masks.bits[i] <= 8)
+            masks.masks[i] = (masks.masks[i] >> masks.shifts[i]) << (8 - masks.bits[i]);
     }
 
+    QImage image = createImage(target, width, height, format);
+    decodeLines(data, qint64(width) * (masks.bitCount / 8), masks, image, readUnsignedLineRange);
     return image;
 }
 
-static QImage readL6V5U5(QDataStream &s, quint32 width, quint32 height)
+// Handles subnormals, infinities and NaN like an IEEE conversion would
+static float halfToFloat(quint16 value)
 {
-    QImage image(width, height, QImage::Format_ARGB32);
+    const float sign = (value & 0x8000) ? -1.0f : 1.0f;
+    const int exp = (value & 0x7C00) >> 10;
+    const int fraction = value & 0x3FF;
 
-    quint16 tmp;
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            s >> tmp;
-            quint8 r = qint8((tmp & 0x001f) >> 0) * 0xff/0x1f + 128;
-            quint8 g = qint8((tmp & 0x03e0) >> 5) * 0xff/0x1f + 128;
-            quint8 b = quint8((tmp & 0xfc00) >> 10) * 0xff/0x3f;
-            line[x] = qRgba(r, g, 0xff, b);
-        }
+    if (exp == 0)
+        return sign * std::ldexp(float(fraction), -24);
+    if (exp == 0x1f)
+        return fraction ? std::numeric_limits<float>::quiet_NaN() : sign * std::numeric_limits<float>::infinity();
+    return sign * std::ldexp(float(fraction + 1024), exp - 25);
+}
+
+static inline float readFloat32(const uchar *data)
+{
+    Q_STATIC_ASSERT(sizeof(float) == sizeof(quint32));
+    const quint32 bits = qFromLittleEndian<quint32>(data);
+    float value;
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+// Clamps to [0, 1] and scales to 8 bits, truncating. NaN becomes 0.
+static inline quint8 floatToByte(float value)
+{
+    if (!(value > 0.0f))
+        return 0;
+    if (value >= 1.0f)
+        return 255;
+    return quint8(value * 255);
+}
+
+// floatToByte() of every half float
+struct HalfTable
+{
+    HalfTable()
+    {
+        for (int i = 0; i < 65536; i++)
+            bytes[i] = floatToByte(halfToFloat(i));
     }
-    return image;
+
+    quint8 bytes[65536];
+};
+
+static const HalfTable &halfTable()
+{
+    static const HalfTable table;
+    return table;
 }
 
-static QImage readX8L8V8U8(QDataStream &s, quint32 width, quint32 height)
+// Converts count floats of either width to bytes
+typedef void (*FloatConverter)(const uchar *src, quint8 *dst, quint32 count);
+
+static void halfsToBytes(const uchar *src, quint8 *dst, quint32 count)
 {
-    QImage image(width, height, QImage::Format_ARGB32);
+    const HalfTable &table = halfTable();
+    for (quint32 i = 0; i < count; i++, src += 2)
+        dst[i] = table.bytes[qFromLittleEndian<quint16>(src)];
+}
 
-    quint8 a, l;
-    qint8 v, u;
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            s >> v >> u >> a >> l;
-            line[x] = qRgba(v + 128, u + 128, 255, a);
-        }
+static void floatsToBytes(const uchar *src, quint8 *dst, quint32 count)
+{
+    for (quint32 i = 0; i < count; i++, src += 4)
+        dst[i] = floatToByte(readFloat32(src));
+}
+
+#ifdef DDS_X86_DISPATCH
+// max() and min() pass NaN through as 0, _mm_cvttps_epi32 truncates like
+// the scalar conversion
+DDS_TARGET("sse2")
+static inline __m128i floatsToBytesSSE2(__m128 low, __m128 high)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    low = _mm_mul_ps(_mm_min_ps(_mm_max_ps(low, zero), one), scale);
+    high = _mm_mul_ps(_mm_min_ps(_mm_max_ps(high, zero), one), scale);
+    const __m128i words = _mm_packs_epi32(_mm_cvttps_epi32(low), _mm_cvttps_epi32(high));
+    return _mm_packus_epi16(words, words);
+}
+
+DDS_TARGET("sse2")
+static void floatsToBytesSSE2(const uchar *src, quint8 *dst, quint32 count)
+{
+    quint32 i = 0;
+    for (; i + 8 <= count; i += 8, src += 32) {
+        const __m128 low = _mm_loadu_ps(reinterpret_cast<const float *>(src));
+        const __m128 high = _mm_loadu_ps(reinterpret_cast<const float *>(src + 16));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), floatsToBytesSSE2(low, high));
     }
+    floatsToBytes(src, dst + i, count - i);
+}
 
-    return image;
+DDS_TARGET("sse2,f16c")
+static void halfsToBytesF16C(const uchar *src, quint8 *dst, quint32 count)
+{
+    quint32 i = 0;
+    for (; i + 8 <= count; i += 8, src += 16) {
+        const __m128i halfs = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128 low = _mm_cvtph_ps(halfs);
+        const __m128 high = _mm_cvtph_ps(_mm_unpackhi_epi64(halfs, halfs));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), floatsToBytesSSE2(low, high));
+    }
+    halfsToBytes(src, dst + i, count - i);
 }
+#endif // DDS_X86_DISPATCH
 
-static QImage readQ8W8V8U8(QDataStream &s, quint32 width, quint32 height)
+static FloatConverter selectFloatConverter(bool half)
 {
-    QImage image(width, height, QImage::Format_ARGB32);
+#ifdef DDS_X86_DISPATCH
+    if (half && (cpuFeatures() & CpuF16C))
+        return halfsToBytesF16C;
+    if (!half && (cpuFeatures() & CpuSSE2))
+        return floatsToBytesSSE2;
+#endif
+    return half ? halfsToBytes : floatsToBytes;
+}
 
-    quint8 colors[ColorCount];
-    qint8 tmp;
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            for (int i = 0; i < ColorCount; i++) {
-                s >> tmp;
-                colors[i] = tmp + 128;
+// Reads R, RG or RGBA floats, one chunk of each line at a time. Formats
+// without alpha leave the alpha bytes at 0 like the other readers.
+template <int channels, bool half>
+static void readFloatLineRange(LineRange<FloatConverter> &range)
+{
+    enum { ChunkSize = 256, FloatSize = half ? 2 : 4 };
+
+    quint8 bytes[channels * ChunkSize];
+    for (quint32 y = range.first; y < range.last; y++) {
+        const uchar *src = range.sourceLine(y);
+        QRgb *line = range.line(y);
+        for (quint32 x = 0; x < range.width; x += ChunkSize) {
+            const quint32 count = qMin<quint32>(ChunkSize, range.width - x);
+            range.context(src, bytes, channels * count);
+            src += channels * count * FloatSize;
+
+            for (quint32 i = 0; i < count; i++) {
+                const quint8 *pixel = bytes + channels * i;
+                line[x + i] = qRgba(pixel[0],
+                                    channels > 1 ? pixel[1] : 0,
+                                    channels > 2 ? pixel[2] : 0,
+                                    channels > 3 ? pixel[3] : 0);
             }
-            line[x] = qRgba(colors[Red], colors[Green], colors[Blue], colors[Alpha]);
         }
     }
+}
+
+template <int channels, bool half>
+static QImage readFloatImage(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    const QImage::Format format = channels == 4 ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+    QImage image = createImage(target, width, height, format);
+
+    static const FloatConverter convert = selectFloatConverter(half);
+    decodeLines(data, qint64(width) * channels * (half ? 2 : 4), convert, image,
+                readFloatLineRange<channels, half>);
 
     return image;
 }
 
-static QImage readV16U16(QDataStream &s, quint32 width, quint32 height)
+static QImage readR16F(const uchar *data, const quint32 width, const quint32 height, QImage *target)
 {
-    QImage image(width, height, QImage::Format_RGB32);
+    return readFloatImage<1, true>(data, width, height, target);
+}
 
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            qint16 v, u;
-            s >> v >> u;
-            v = (v + 0x8000) >> 8;
-            u = (u + 0x8000) >> 8;
-            line[x] = qRgb(v, u, 255);
-        }
-    }
+static QImage readRG16F(const uchar *data, const quint32 width, const quint32 height, QImage *target)
+{
+    return readFloatImage<2, true>(data, width, height, target);
+}
 
-    return image;
+static QImage readARGB16F(const uchar *data, const quint32 width, const quint32 height, QImage *target)
+{
+    return readFloatImage<4, true>(data, width, height, target);
 }
 
-static QImage readA2W10V10U10(QDataStream &s, quint32 width, quint32 height)
+static QImage readR32F(const uchar *data, const quint32 width, const quint32 height, QImage *target)
 {
-    QImage image(width, height, QImage::Format_ARGB32);
+    return readFloatImage<1, false>(data, width, height, target);
+}
 
-    quint32 tmp;
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            s >> tmp;
-            quint8 r = qint8((tmp & 0x3ff00000) >> 20 >> 2) + 128;
-            quint8 g = qint8((tmp & 0x000ffc00) >> 10 >> 2) + 128;
-            quint8 b = qint8((tmp & 0x000003ff) >> 0 >> 2) + 128;
-            quint8 a = 0xff * ((tmp & 0xc0000000) >> 30) / 3;
-            // dunno why we should swap b and r here
-            std::swap(b, r);
-            line[x] = qRgba(r, g, b, a);
-        }
+static QImage readRG32F(const uchar *data, const quint32 width, const quint32 height, QImage *target)
+{
+    return readFloatImage<2, false>(data, width, height, target);
+}
+
+static QImage readARGB32F(const uchar *data, const quint32 width, const quint32 height, QImage *target)
+{
+    return readFloatImage<4, false>(data, width, height, target);
+}
+
+static void readCxV8U8Line(const uchar *src, QRgb *line, quint32 width)
+{
+    const NormalZTable &normalZ = normalZTable();
+    for (quint32 x = 0; x < width; x++, src += 2) {
+        const quint8 vn = quint8(qint8(src[0]) + 128);
+        const quint8 un = quint8(qint8(src[1]) + 128);
+        line[x] = qRgb(vn, un, normalZ.z[vn][un]);
     }
+}
 
-    return image;
+static QImage readCxV8U8(const uchar *data, const quint32 width, const quint32 height, QImage *target)
+{
+    return readLines(data, width, height, 2, QImage::Format_RGB32, readCxV8U8Line, target);
 }
 
-static QImage readUYVY(QDataStream &s, quint32 width, quint32 height)
+// Palette entries are stored as R, G, B, A
+static void readPalette(const uchar *src, QRgb *palette, int count)
 {
-    QImage image(width, height, QImage::Format_RGB32);
+    for (int i = 0; i < count; ++i) {
+        palette[i] = qRgba(src[0], src[1], src[2], src[3]);
+        src += 4;
+    }
+}
 
-    quint8 uyvy[4];
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width - 1; ) {
-            s >> uyvy[0] >> uyvy[1] >> uyvy[2] >> uyvy[3];
-            line[x++] = yuv2rgb(uyvy[1], uyvy[0], uyvy[2]);
-            line[x++] = yuv2rgb(uyvy[3], uyvy[0], uyvy[2]);
-        }
-        if (width % 2 == 1) {
-            s >> uyvy[0] >> uyvy[1] >> uyvy[2] >> uyvy[3];
-            line[width - 1] = yuv2rgb(uyvy[1], uyvy[0], uyvy[2]);
-        }
+#ifdef DDS_X86_DISPATCH
+DDS_TARGET("avx2")
+static void expandPalette8AVX2(const uchar *src, QRgb *line, quint32 width, const QRgb *palette)
+{
+    quint32 x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + x)));
+        const __m256i colors = _mm256_i32gather_epi32(reinterpret_cast<const int *>(palette), indices, 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(line + x), colors);
     }
+    for (; x < width; x++)
+        line[x] = palette[src[x]];
+}
 
-    return image;
+// Splits 16 packed bytes into 32 indices, low nibble first
+DDS_TARGET("sse2")
+static inline void unpackNibblesSSE2(const uchar *src, __m128i &first, __m128i &second)
+{
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    const __m128i low = _mm_and_si128(bytes, mask);
+    const __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+    first = _mm_unpacklo_epi8(low, high);
+    second = _mm_unpackhi_epi8(low, high);
 }
 
-static QImage readR8G8B8G8(QDataStream &s, quint32 width, quint32 height)
+DDS_TARGET("sse2")
+static quint32 unpackPalette4SSE2(const uchar *src, uchar *line, quint32 width)
 {
-    QImage image(width, height, QImage::Format_RGB32);
-    quint8 rgbg[4];
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width - 1; ) {
-            s >> rgbg[1] >> rgbg[0] >> rgbg[3] >> rgbg[2];
-            line[x++] = qRgb(rgbg[0], rgbg[1], rgbg[2]);
-            line[x++] = qRgb(rgbg[0], rgbg[3], rgbg[2]);
-        }
-        if (width % 2 == 1) {
-            s >> rgbg[1] >> rgbg[0] >> rgbg[3] >> rgbg[2];
-            line[width - 1] = qRgb(rgbg[0], rgbg[1], rgbg[2]);
-        }
+    quint32 x = 0;
+    for (; x + 32 <= width; x += 32, src += 16) {
+        __m128i first;
+        __m128i second;
+        unpackNibblesSSE2(src, first, second);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + x), first);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + x + 16), second);
     }
+    return x;
+}
 
-    return image;
+// The 16 colours fit in one register per channel, so each index is
+// looked up with pshufb
+DDS_TARGET("ssse3")
+static inline void storeColorsSSSE3(QRgb *dst, __m128i indices, const __m128i *planes)
+{
+    const __m128i b = _mm_shuffle_epi8(planes[0], indices);
+    const __m128i g = _mm_shuffle_epi8(planes[1], indices);
+    const __m128i r = _mm_shuffle_epi8(planes[2], indices);
+    const __m128i a = _mm_shuffle_epi8(planes[3], indices);
+    const __m128i bgLow = _mm_unpacklo_epi8(b, g);
+    const __m128i bgHigh = _mm_unpackhi_epi8(b, g);
+    const __m128i raLow = _mm_unpacklo_epi8(r, a);
+    const __m128i raHigh = _mm_unpackhi_epi8(r, a);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi16(bgLow, raLow));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4), _mm_unpackhi_epi16(bgLow, raLow));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8), _mm_unpacklo_epi16(bgHigh, raHigh));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 12), _mm_unpackhi_epi16(bgHigh, raHigh));
+}
+
+DDS_TARGET("ssse3")
+static quint32 expandPalette4SSSE3(const uchar *src, QRgb *line, quint32 width, const QRgb *palette)
+{
+    uchar channels[4][16];
+    for (int i = 0; i < 16; i++) {
+        channels[0][i] = qBlue(palette[i]);
+        channels[1][i] = qGreen(palette[i]);
+        channels[2][i] = qRed(palette[i]);
+        channels[3][i] = qAlpha(palette[i]);
+    }
+    __m128i planes[4];
+    for (int c = 0; c < 4; c++)
+        planes[c] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(channels[c]));
+
+    quint32 x = 0;
+    for (; x + 32 <= width; x += 32, src += 16) {
+        __m128i first;
+        __m128i second;
+        unpackNibblesSSE2(src, first, second);
+        storeColorsSSSE3(line + x, first, planes);
+        storeColorsSSSE3(line + x + 16, second, planes);
+    }
+    return x;
 }
+#endif // DDS_X86_DISPATCH
 
-static QImage readYUY2(QDataStream &s, quint32 width, quint32 height)
+static QImage readPalette8Image(const uchar *data, quint32 width, quint32 height, bool expand, QImage *target)
 {
-    QImage image(width, height, QImage::Format_RGB32);
+    QRgb palette[256];
+    readPalette(data, palette, 256);
+    const uchar *src = data + sizeof(palette);
+
+    if (!expand) {
+        QImage image = createImage(target, width, height, QImage::Format_Indexed8);
+        for (int i = 0; i < 256; ++i)
+            image.setColor(i, palette[i]);
+
+        for (quint32 y = 0; y < height; y++, src += width)
+            memcpy(image.scanLine(y), src, width);
+
+        return image;
+    }
 
-    quint8 yuyv[4];
-    for (quint32 y = 0; y < height; y++) {
+    QImage image = createImage(target, width, height, QImage::Format_ARGB32);
+
+#ifdef DDS_X86_DISPATCH
+    const bool avx2 = cpuFeatures() & CpuAVX2;
+#endif
+
+    for (quint32 y = 0; y < height; y++, src += width) {
         QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width - 1; ) {
-            s >> yuyv[0] >> yuyv[1] >> yuyv[2] >> yuyv[3];
-            line[x++] = yuv2rgb(yuyv[0], yuyv[1], yuyv[3]);
-            line[x++] = yuv2rgb(yuyv[2], yuyv[1], yuyv[3]);
-        }
-        if (width % 2 == 1) {
-            s >> yuyv[0] >> yuyv[1] >> yuyv[2] >> yuyv[3];
-            line[width - 1] = yuv2rgb(yuyv[2], yuyv[1], yuyv[3]);
+#ifdef DDS_X86_DISPATCH
+        if (avx2) {
+            expandPalette8AVX2(src, line, width, palette);
+            continue;
         }
+#endif
+        for (quint32 x = 0; x < width; x++)
+            line[x] = palette[src[x]];
     }
 
     return image;
 }
 
-static QImage readG8R8G8B8(QDataStream &s, quint32 width, quint32 height)
+static QImage readPalette4Image(const uchar *data, quint32 width, quint32 height, bool expand, QImage *target)
 {
-    QImage image(width, height, QImage::Format_RGB32);
-    quint8 grgb[4];
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width - 1; ) {
-            s >> grgb[1] >> grgb[0] >> grgb[3] >> grgb[2];
-            line[x++] = qRgb(grgb[1], grgb[0], grgb[3]);
-            line[x++] = qRgb(grgb[1], grgb[2], grgb[3]);
-        }
-        if (width % 2 == 1) {
-            s >> grgb[1] >> grgb[0] >> grgb[3] >> grgb[2];
-            line[width - 1] = qRgb(grgb[1], grgb[0], grgb[3]);
+    QRgb palette[16];
+    readPalette(data, palette, 16);
+    const uchar *src = data + sizeof(palette);
+
+    QImage image = createImage(target, width, height, expand ? QImage::Format_ARGB32 : QImage::Format_Indexed8);
+    if (!expand) {
+        for (int i = 0; i < 16; ++i)
+            image.setColor(i, palette[i]);
+    }
+
+#ifdef DDS_X86_DISPATCH
+    const uint features = cpuFeatures();
+#endif
+
+    const quint32 bytesPerLine = (width + 1) / 2;
+    for (quint32 y = 0; y < height; y++, src += bytesPerLine) {
+        uchar *line = image.scanLine(y);
+        QRgb *colors = reinterpret_cast<QRgb *>(line);
+
+        // Vector code handles groups of 32 pixels, the rest is done here
+        quint32 x = 0;
+#ifdef DDS_X86_DISPATCH
+        if (expand && (features & CpuSSSE3))
+            x = expandPalette4SSSE3(src, colors, width, palette);
+        else if (!expand && (features & CpuSSE2))
+            x = unpackPalette4SSE2(src, line, width);
+#endif
+        for (; x < width; x++) {
+            const quint8 index = (src[x / 2] >> (4 * (x % 2))) & 0x0f;
+            if (expand)
+                colors[x] = palette[index];
+            else
+                line[x] = index;
         }
     }
 
     return image;
 }
 
-static QImage readA2R10G10B10(QDataStream &s, const DDSHeader &dds, quint32 width, quint32 height)
+// Only the high byte of every 16-bit channel is kept
+static void readARGB16Line(const uchar *src, QRgb *line, quint32 width)
 {
-    QImage image = readUnsignedImage(s, dds, width, height, true);
-    for (quint32 y = 0; y < height; y++) {
-        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
-        for (quint32 x = 0; x < width; x++) {
-            QRgb pixel = image.pixel(x, y);
-            line[x] = qRgba(qBlue(pixel), qGreen(pixel), qRed(pixel), qAlpha(pixel));
-        }
+    quint8 colors[ColorCount];
+    for (quint32 x = 0; x < width; x++) {
+        for (int i = 0; i < ColorCount; ++i, src += 2)
+            colors[i] = quint8(qFromLittleEndian<quint16>(src) >> 8);
+        line[x] = qRgba(colors[Red], colors[Green], colors[Blue], colors[Alpha]);
     }
-    return image;
 }
 
-static QImage readLayer(QDataStream &s, const DDSHeader &dds, const int format, quint32 width, quint32 height)
+static QImage readARGB16(const uchar *data, quint32 width, quint32 height, QImage *target)
 {
-    if (width * height == 0)
-        return QImage();
+    return readLines(data, width, height, 8, QImage::Format_ARGB32, readARGB16Line, target);
+}
 
-    switch (format) {
-    case FormatR8G8B8:
-    case FormatX8R8G8B8:
-    case FormatR5G6B5:
-    case FormatR3G3B2:
-    case FormatX1R5G5B5:
-    case FormatX4R4G4B4:
-    case FormatX8B8G8R8:
-    case FormatG16R16:
-    case FormatL8:
-    case FormatL16:
-        return readUnsignedImage(s, dds, width, height, false);
-    case FormatA8R8G8B8:
-    case FormatA1R5G5B5:
-    case FormatA4R4G4B4:
-    case FormatA8:
-    case FormatA8R3G3B2:
-    case FormatA8B8G8R8:
-    case FormatA8L8:
-    case FormatA4L4:
-        return readUnsignedImage(s, dds, width, height, true);
-    case FormatA2R10G10B10:
-    case FormatA2B10G10R10:
-        return readA2R10G10B10(s, dds, width, height);
-    case FormatP8:
-    case FormatA8P8:
-        return readPalette8Image(s, width, height);
-    case FormatP4:
-    case FormatA4P4:
-        return readPalette4Image(s, width, height);
-    case FormatA16B16G16R16:
-        return readARGB16(s, width, height);
-    case FormatV8U8:
-        return readV8U8(s, width, height);
-    case FormatL6V5U5:
-        return readL6V5U5(s, width, height);
-    case FormatX8L8V8U8:
-        return readX8L8V8U8(s, width, height);
-    case FormatQ8W8V8U8:
-        return readQ8W8V8U8(s, width, height);
-    case FormatV16U16:
-        return readV16U16(s, width, height);
-    case FormatA2W10V10U10:
-        return readA2W10V10U10(s, width, height);
-    case FormatUYVY:
-        return readUYVY(s, width, height);
-    case FormatR8G8B8G8:
-        return readR8G8B8G8(s, width, height);
-    case FormatYUY2:
-        return readYUY2(s, width, height);
-    case FormatG8R8G8B8:
-        return readG8R8G8B8(s, width, height);
-    case FormatDXT1:
-        return readDXT1(s, width, height);
-    case FormatDXT2:
-        return readDXT2(s, width, height);
-    case FormatDXT3:
-        return readDXT3(s, width, height);
-    case FormatDXT4:
-        return readDXT4(s, width, height);
-    case FormatDXT5:
-        return readDXT5(s, width, height);
-    case FormatRXGB:
-        return readRXGB(s, width, height);
-    case FormatATI2:
-        return readATI2(s, width, height);
-    case FormatR16F:
-        return readR16F(s, width, height);
-    case FormatG16R16F:
-        return readRG16F(s, width, height);
-    case FormatA16B16G16R16F:
-        return readARGB16F(s, width, height);
-    case FormatR32F:
-        return readR32F(s, width, height);
-    case FormatG32R32F:
-        return readRG32F(s, width, height);
-    case FormatA32B32G32R32F:
-        return readARGB32F(s, width, height);
-    case FormatD16Lockable:
-    case FormatD32:
-    case FormatD15S1:
-    case FormatD24S8:
-    case FormatD24X8:
-    case FormatD24X4S4:
-    case FormatD16:
-    case FormatD32FLockable:
-    case FormatD24FS8:
-    case FormatD32Lockable:
-    case FormatS8Lockable:
-    case FormatVertexData:
-    case FormatIndex16:
-    case FormatIndex32:
-        break;
-    case FormatQ16W16V16U16:
-        return readQ16W16V16U16(s, width, height);
-    case FormatMulti2ARGB8:
-        break;
-    case FormatCxV8U8:
-        return readCxV8U8(s, width, height);
-    case FormatA1:
-    case FormatA2B10G10R10_XR_BIAS:
-    case FormatBinaryBuffer:
-    case FormatLast:
-        break;
+#ifdef DDS_X86_DISPATCH
+#define DDS_SELECT(plain, vector, feature) ((cpuFeatures() & (feature)) ? (vector) : (plain))
+#else
+#define DDS_SELECT(plain, vector, feature) (plain)
+#endif
+
+// The signed formats are biased by 128, for a byte that is the same as
+// flipping its top bit
+static void readV8U8Line(const uchar *src, QRgb *line, quint32 width)
+{
+    for (quint32 x = 0; x < width; x++, src += 2)
+        line[x] = qRgb(src[0] ^ 0x80, src[1] ^ 0x80, 255);
+}
+
+static void readL6V5U5Line(const uchar *src, QRgb *line, quint32 width)
+{
+    for (quint32 x = 0; x < width; x++, src += 2) {
+        const quint16 tmp = qFromLittleEndian<quint16>(src);
+        quint8 r = qint8((tmp & 0x001f) >> 0) * 0xff/0x1f + 128;
+        quint8 g = qint8((tmp & 0x03e0) >> 5) * 0xff/0x1f + 128;
+        quint8 b = quint8((tmp & 0xfc00) >> 10) * 0xff/0x3f;
+        line[x] = qRgba(r, g, 0xff, b);
     }
+}
 
-    return QImage();
+static void readX8L8V8U8Line(const uchar *src, QRgb *line, quint32 width)
+{
+    for (quint32 x = 0; x < width; x++, src += 4)
+        line[x] = qRgba(src[0] ^ 0x80, src[1] ^ 0x80, 255, src[2]);
 }
 
-static inline QImage readTexture(QDataStream &s, const DDSHeader &dds, const int format, const int mipmapLevel)
+static void readQ8W8V8U8Line(const uchar *src, QRgb *line, quint32 width)
 {
-    quint32 width = dds.width / (1 << mipmapLevel);
-    quint32 height = dds.height / (1 << mipmapLevel);
-    return readLayer(s, dds, format, width, height);
+    for (quint32 x = 0; x < width; x++, src += 4)
+        line[x] = qRgba(src[0] ^ 0x80, src[1] ^ 0x80, src[2] ^ 0x80, src[3] ^ 0x80);
 }
 
-static qint64 mipmapSize(const DDSHeader &dds, const int format, const int level)
+// (v + 0x8000) >> 8 is the high byte with its top bit flipped
+static void readV16U16Line(const uchar *src, QRgb *line, quint32 width)
 {
-    quint32 w = dds.width/(1 << level);
-    quint32 h = dds.height/(1 << level);
+    for (quint32 x = 0; x < width; x++, src += 4)
+        line[x] = qRgb(src[1] ^ 0x80, src[3] ^ 0x80, 255);
+}
 
-    switch (format) {
-    case FormatR8G8B8:
-    case FormatX8R8G8B8:
-    case FormatR5G6B5:
-    case FormatX1R5G5B5:
-    case FormatX4R4G4B4:
-    case FormatX8B8G8R8:
-    case FormatG16R16:
-    case FormatL8:
-    case FormatL16:
-        return w * h * dds.pixelFormat.rgbBitCount / 8;
-    case FormatA8R8G8B8:
-    case FormatA1R5G5B5:
-    case FormatA4R4G4B4:
-    case FormatA8:
+// W and U end up swapped, the 2-bit alpha is scaled by 85
+static inline QRgb A2W10V10U10ToRgb(quint32 value)
+{
+    return (((value >> 30) * 0x55) << 24)
+            | (((value << 14) & 0xff0000) | ((value >> 4) & 0xff00) | ((value >> 22) & 0xff)) ^ 0x808080;
+}
+
+static void readA2W10V10U10Line(const uchar *src, QRgb *line, quint32 width)
+{
+    for (quint32 x = 0; x < width; x++, src += 4)
+        line[x] = A2W10V10U10ToRgb(qFromLittleEndian<quint32>(src));
+}
+
+static void readQ16W16V16U16Line(const uchar *src, QRgb *line, quint32 width)
+{
+    quint8 colors[ColorCount];
+    for (quint32 x = 0; x < width; x++) {
+        for (int i = 0; i < ColorCount; i++) {
+            const qint16 tmp = qFromLittleEndian<qint16>(src);
+            src += 2;
+            colors[i] = (tmp + 0x7FFF) >> 8;
+        }
+        line[x] = qRgba(colors[Red], colors[Green], colors[Blue], colors[Alpha]);
+    }
+}
+
+#ifdef DDS_X86_DISPATCH
+// Moves the bytes of 16 source bytes into place with two shuffles, the
+// second mask is the first moved up by half a register. Shuffle entries of
+// -128 give zero bytes that fill is or'ed into.
+DDS_TARGET("ssse3")
+static inline void shuffleHalvesSSSE3(__m128i bytes, __m128i low, __m128i fill, QRgb *dst)
+{
+    const __m128i high = _mm_add_epi8(low, _mm_set1_epi8(8));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(_mm_shuffle_epi8(bytes, low), fill));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4), _mm_or_si128(_mm_shuffle_epi8(bytes, high), fill));
+}
+
+DDS_TARGET("ssse3")
+static void readV8U8LineSSSE3(const uchar *src, QRgb *line, quint32 width)
+{
+    const __m128i sign = _mm_set1_epi8(char(0x80));
+    const __m128i mask = _mm_setr_epi8(-128, 1, 0, -128, -128, 3, 2, -128, -128, 5, 4, -128, -128, 7, 6, -128);
+    const __m128i opaque = _mm_set1_epi32(int(0xff0000ff));
+    quint32 x = 0;
+    for (; x + 8 <= width; x += 8, src += 16) {
+        const __m128i bytes = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), sign);
+        shuffleHalvesSSSE3(bytes, mask, opaque, line + x);
+    }
+    readV8U8Line(src, line + x, width - x);
+}
+
+DDS_TARGET("ssse3")
+static void readX8L8V8U8LineSSSE3(const uchar *src, QRgb *line, quint32 width)
+{
+    const __m128i sign = _mm_set1_epi32(0x8080);
+    const __m128i mask = _mm_setr_epi8(-128, 1, 0, 2, -128, 5, 4, 6, -128, 9, 8, 10, -128, 13, 12, 14);
+    const __m128i blue = _mm_set1_epi32(0xff);
+    quint32 x = 0;
+    for (; x + 4 <= width; x += 4, src += 16) {
+        const __m128i bytes = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), sign);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + x), _mm_or_si128(_mm_shuffle_epi8(bytes, mask), blue));
+    }
+    readX8L8V8U8Line(src, line + x, width - x);
+}
+
+DDS_TARGET("ssse3")
+static void readQ8W8V8U8LineSSSE3(const uchar *src, QRgb *line, quint32 width)
+{
+    const __m128i sign = _mm_set1_epi8(char(0x80));
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    quint32 x = 0;
+    for (; x + 4 <= width; x += 4, src += 16) {
+        const __m128i bytes = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), sign);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + x), _mm_shuffle_epi8(bytes, mask));
+    }
+    readQ8W8V8U8Line(src, line + x, width - x);
+}
+
+DDS_TARGET("ssse3")
+static void readV16U16LineSSSE3(const uchar *src, QRgb *line, quint32 width)
+{
+    const __m128i sign = _mm_set1_epi8(char(0x80));
+    const __m128i mask = _mm_setr_epi8(-128, 3, 1, -128, -128, 7, 5, -128, -128, 11, 9, -128, -128, 15, 13, -128);
+    const __m128i opaque = _mm_set1_epi32(int(0xff0000ff));
+    quint32 x = 0;
+    for (; x + 4 <= width; x += 4, src += 16) {
+        const __m128i bytes = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), sign);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + x), _mm_or_si128(_mm_shuffle_epi8(bytes, mask), opaque));
+    }
+    readV16U16Line(src, line + x, width - x);
+}
+
+// ((v ^ 0x8000) - 1) >> 8 in unsigned 16-bit lanes is (v + 0x7fff) >> 8,
+// including the wrap of -0x8000 to 0xff
+DDS_TARGET("ssse3")
+static void readQ16W16V16U16LineSSSE3(const uchar *src, QRgb *line, quint32 width)
+{
+    const __m128i sign = _mm_set1_epi16(short(0x8000));
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    quint32 x = 0;
+    for (; x + 4 <= width; x += 4, src += 32) {
+        const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+        const __m128i low = _mm_srli_epi16(_mm_sub_epi16(_mm_xor_si128(first, sign), one), 8);
+        const __m128i high = _mm_srli_epi16(_mm_sub_epi16(_mm_xor_si128(second, sign), one), 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + x), _mm_shuffle_epi8(_mm_packus_epi16(low, high), mask));
+    }
+    readQ16W16V16U16Line(src, line + x, width - x);
+}
+
+// x * 255 / 31 is (x * 2106) >> 8 and x * 255 / 63 is 4x + (x * 49) >> 10
+// for all the 5- and 6-bit inputs
+DDS_TARGET("sse2")
+static void readL6V5U5LineSSE2(const uchar *src, QRgb *line, quint32 width)
+{
+    const __m128i five = _mm_set1_epi16(0x1f);
+    const __m128i sign = _mm_set1_epi16(0x80);
+    const __m128i blue = _mm_set1_epi16(0xff);
+    quint32 x = 0;
+    for (; x + 8 <= width; x += 8, src += 16) {
+        const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128i u = _mm_and_si128(value, five);
+        const __m128i v = _mm_and_si128(_mm_srli_epi16(value, 5), five);
+        const __m128i l = _mm_srli_epi16(value, 10);
+        const __m128i r = _mm_xor_si128(_mm_srli_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(2106)), 8), sign);
+        const __m128i g = _mm_xor_si128(_mm_srli_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(2106)), 8), sign);
+        const __m128i a = _mm_add_epi16(_mm_slli_epi16(l, 2), _mm_srli_epi16(_mm_mullo_epi16(l, _mm_set1_epi16(49)), 10));
+        const __m128i low = _mm_or_si128(_mm_slli_epi16(g, 8), blue);
+        const __m128i high = _mm_or_si128(_mm_slli_epi16(a, 8), r);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + x), _mm_unpacklo_epi16(low, high));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + x + 4), _mm_unpackhi_epi16(low, high));
+    }
+    readL6V5U5Line(src, line + x, width - x);
+}
+
+DDS_TARGET("sse2")
+static void readA2W10V10U10LineSSE2(const uchar *src, QRgb *line, quint32 width)
+{
+    const __m128i sign = _mm_set1_epi32(0x808080);
+    quint32 x = 0;
+    for (; x + 4 <= width; x += 4, src += 16) {
+        const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128i red = _mm_and_si128(_mm_slli_epi32(value, 14), _mm_set1_epi32(0xff0000));
+        const __m128i green = _mm_and_si128(_mm_srli_epi32(value, 4), _mm_set1_epi32(0xff00));
+        const __m128i blue = _mm_and_si128(_mm_srli_epi32(value, 22), _mm_set1_epi32(0xff));
+        __m128i alpha = _mm_srli_epi32(value, 30);
+        alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 2));
+        alpha = _mm_slli_epi32(_mm_or_si128(alpha, _mm_slli_epi32(alpha, 4)), 24);
+        const __m128i color = _mm_xor_si128(_mm_or_si128(_mm_or_si128(red, green), blue), sign);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + x), _mm_or_si128(color, alpha));
+    }
+    readA2W10V10U10Line(src, line + x, width - x);
+}
+#endif // DDS_X86_DISPATCH
+
+static QImage readV8U8(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readLines(data, width, height, 2, QImage::Format_RGB32,
+                     DDS_SELECT(readV8U8Line, readV8U8LineSSSE3, CpuSSSE3), target);
+}
+
+static QImage readL6V5U5(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readLines(data, width, height, 2, QImage::Format_ARGB32,
+                     DDS_SELECT(readL6V5U5Line, readL6V5U5LineSSE2, CpuSSE2), target);
+}
+
+static QImage readX8L8V8U8(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readLines(data, width, height, 4, QImage::Format_ARGB32,
+                     DDS_SELECT(readX8L8V8U8Line, readX8L8V8U8LineSSSE3, CpuSSSE3), target);
+}
+
+static QImage readQ8W8V8U8(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readLines(data, width, height, 4, QImage::Format_ARGB32,
+                     DDS_SELECT(readQ8W8V8U8Line, readQ8W8V8U8LineSSSE3, CpuSSSE3), target);
+}
+
+static QImage readV16U16(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readLines(data, width, height, 4, QImage::Format_RGB32,
+                     DDS_SELECT(readV16U16Line, readV16U16LineSSSE3, CpuSSSE3), target);
+}
+
+static QImage readA2W10V10U10(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readLines(data, width, height, 4, QImage::Format_ARGB32,
+                     DDS_SELECT(readA2W10V10U10Line, readA2W10V10U10LineSSE2, CpuSSE2), target);
+}
+
+static QImage readQ16W16V16U16(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readLines(data, width, height, 8, QImage::Format_ARGB32,
+                     DDS_SELECT(readQ16W16V16U16Line, readQ16W16V16U16LineSSSE3, CpuSSSE3), target);
+}
+
+#undef DDS_SELECT
+
+// Converts pairs of 4:2:2 pixels, U Y V Y for UYVY and Y U Y V for YUY2
+typedef void (*YuvLineConverter)(const uchar *src, QRgb *line, quint32 pairs, const YuvCoefficients &k);
+
+template <bool lumaFirst>
+static void convertYuv422(const uchar *src, QRgb *line, quint32 pairs, const YuvCoefficients &k)
+{
+    const int y0 = lumaFirst ? 0 : 1;
+    const int c0 = lumaFirst ? 1 : 0;
+    for (quint32 i = 0; i < pairs; i++, src += 4) {
+        line[2 * i] = yuv2rgb(src[y0], src[c0], src[c0 + 2], k);
+        line[2 * i + 1] = yuv2rgb(src[y0 + 2], src[c0], src[c0 + 2], k);
+    }
+}
+
+#ifdef DDS_X86_DISPATCH
+// Same arithmetic as yuv2rgb(), eight pixels at a time. Each 16-bit lane
+// holds one luma and one chroma byte, so the chroma lanes come out as U, V
+// pairs that _mm_madd_epi16 multiplies with both coefficients at once.
+template <bool lumaFirst>
+DDS_TARGET("sse2")
+static void convertYuv422SSE2(const uchar *src, QRgb *line, quint32 pairs, const YuvCoefficients &k)
+{
+    const __m128i byteMask = _mm_set1_epi16(0xff);
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i rounding = _mm_set1_epi32(1 << 12);
+    const __m128i red = _mm_set1_epi32(k.rv << 16);
+    const __m128i green = _mm_set1_epi32(int((quint32(-k.gv) << 16) | (quint32(-k.gu) & 0xffff)));
+    const __m128i blue = _mm_set1_epi32(k.bu & 0xffff);
+    const __m128i opaque = _mm_set1_epi16(0xff);
+
+    quint32 i = 0;
+    for (; i + 4 <= pairs; i += 4, src += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128i luma = lumaFirst ? _mm_and_si128(bytes, byteMask) : _mm_srli_epi16(bytes, 8);
+        const __m128i chroma = _mm_sub_epi16(lumaFirst ? _mm_srli_epi16(bytes, 8) : _mm_and_si128(bytes, byteMask), bias);
+
+        __m128i channels[3][2];
+        for (int half = 0; half < 2; half++) {
+            const __m128i uv = half ? _mm_unpackhi_epi32(chroma, chroma) : _mm_unpacklo_epi32(chroma, chroma);
+            const __m128i y = _mm_add_epi32(_mm_slli_epi32(half ? _mm_unpackhi_epi16(luma, _mm_setzero_si128())
+                                                                : _mm_unpacklo_epi16(luma, _mm_setzero_si128()), 13), rounding);
+            channels[0][half] = _mm_srai_epi32(_mm_add_epi32(y, _mm_madd_epi16(uv, red)), 13);
+            channels[1][half] = _mm_srai_epi32(_mm_add_epi32(y, _mm_madd_epi16(uv, green)), 13);
+            channels[2][half] = _mm_srai_epi32(_mm_add_epi32(y, _mm_madd_epi16(uv, blue)), 13);
+        }
+
+        // Saturate to bytes and interleave to B, G, R, A
+        const __m128i br = _mm_packus_epi16(_mm_packs_epi32(channels[2][0], channels[2][1]),
+                                            _mm_packs_epi32(channels[0][0], channels[0][1]));
+        const __m128i ga = _mm_packus_epi16(_mm_packs_epi32(channels[1][0], channels[1][1]), opaque);
+        const __m128i bg = _mm_unpacklo_epi8(br, ga);
+        const __m128i ra = _mm_unpackhi_epi8(br, ga);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + 2 * i), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + 2 * i + 4), _mm_unpackhi_epi16(bg, ra));
+    }
+
+    convertYuv422<lumaFirst>(src, line + 2 * i, pairs - i, k);
+}
+#endif // DDS_X86_DISPATCH
+
+template <bool lumaFirst>
+static YuvLineConverter selectYuvConverter()
+{
+#ifdef DDS_X86_DISPATCH
+    if (cpuFeatures() & CpuSSE2)
+        return convertYuv422SSE2<lumaFirst>;
+#endif
+    return convertYuv422<lumaFirst>;
+}
+
+struct YuvLines
+{
+    YuvLineConverter convert;
+    YuvCoefficients k;
+};
+
+template <bool lumaFirst>
+static void readYuv422LineRange(LineRange<YuvLines> &range)
+{
+    const YuvCoefficients &k = range.context.k;
+    const quint32 width = range.width;
+    const quint32 pairs = width / 2;
+    for (quint32 y = range.first; y < range.last; y++) {
+        const uchar *src = range.sourceLine(y);
+        QRgb *line = range.line(y);
+        range.context.convert(src, line, pairs, k);
+        src += 4 * pairs;
+        if (width % 2 == 1) {
+            // UYVY takes the first luma of the last pair, YUY2 the second
+            if (lumaFirst)
+                line[width - 1] = yuv2rgb(src[2], src[1], src[3], k);
+            else
+                line[width - 1] = yuv2rgb(src[1], src[0], src[2], k);
+        }
+    }
+}
+
+template <bool lumaFirst>
+static QImage readYuv422(const uchar *data, quint32 width, quint32 height, const YuvCoefficients &k, QImage *target)
+{
+    QImage image = createImage(target, width, height, QImage::Format_RGB32);
+
+    static const YuvLineConverter convert = selectYuvConverter<lumaFirst>();
+    const YuvLines lines = { convert, k };
+    decodeLines(data, 4 * ((qint64(width) + 1) / 2), lines, image, readYuv422LineRange<lumaFirst>);
+
+    return image;
+}
+
+static QImage readUYVY(const uchar *data, quint32 width, quint32 height, const YuvCoefficients &k, QImage *target)
+{
+    return readYuv422<false>(data, width, height, k, target);
+}
+
+static QImage readYUY2(const uchar *data, quint32 width, quint32 height, const YuvCoefficients &k, QImage *target)
+{
+    return readYuv422<true>(data, width, height, k, target);
+}
+
+// R8G8B8G8 and G8R8G8B8 share red and blue between two pixels, the masks
+// give the B, G, R bytes of both pixels of a pair
+struct PackedRgbLayout
+{
+    int first[3];
+    int second[3];
+};
+
+static const PackedRgbLayout rgbgLayout = { { 3, 0, 1 }, { 3, 2, 1 } };
+static const PackedRgbLayout grgbLayout = { { 2, 1, 0 }, { 2, 3, 0 } };
+
+#ifdef DDS_X86_DISPATCH
+// Four pairs at a time, the second two with the mask moved up by 8 bytes.
+// Entries of -128 stay negative and produce the zero alpha bytes.
+DDS_TARGET("ssse3")
+static void shufflePackedRgbSSSE3(const uchar *src, QRgb *line, quint32 pairs, const PackedRgbLayout &layout)
+{
+    char mask[16];
+    for (int p = 0; p < 2; p++) {
+        for (int c = 0; c < 3; c++) {
+            mask[8 * p + c] = char(4 * p + layout.first[c]);
+            mask[8 * p + 4 + c] = char(4 * p + layout.second[c]);
+        }
+        mask[8 * p + 3] = mask[8 * p + 7] = -128;
+    }
+
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask));
+    const __m128i high = _mm_add_epi8(low, _mm_set1_epi8(8));
+    const __m128i opaque = _mm_set1_epi32(int(0xff000000));
+    for (quint32 i = 0; i + 4 <= pairs; i += 4, src += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + 2 * i), _mm_or_si128(_mm_shuffle_epi8(bytes, low), opaque));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + 2 * i + 4), _mm_or_si128(_mm_shuffle_epi8(bytes, high), opaque));
+    }
+}
+#endif // DDS_X86_DISPATCH
+
+static void readPackedRgbLineRange(LineRange<const PackedRgbLayout *> &range)
+{
+    const PackedRgbLayout &layout = *range.context;
+#ifdef DDS_X86_DISPATCH
+    const bool ssse3 = cpuFeatures() & CpuSSSE3;
+#endif
+
+    const quint32 width = range.width;
+    const quint32 pairs = width / 2;
+    for (quint32 y = range.first; y < range.last; y++) {
+        const uchar *src = range.sourceLine(y);
+        QRgb *line = range.line(y);
+        quint32 i = 0;
+#ifdef DDS_X86_DISPATCH
+        if (ssse3) {
+            shufflePackedRgbSSSE3(src, line, pairs, layout);
+            i = pairs & ~3u;
+        }
+#endif
+        for (; i < pairs; i++) {
+            const uchar *pair = src + 4 * i;
+            line[2 * i] = qRgb(pair[layout.first[2]], pair[layout.first[1]], pair[layout.first[0]]);
+            line[2 * i + 1] = qRgb(pair[layout.second[2]], pair[layout.second[1]], pair[layout.second[0]]);
+        }
+        src += 4 * pairs;
+        if (width % 2 == 1)
+            line[width - 1] = qRgb(src[layout.first[2]], src[layout.first[1]], src[layout.first[0]]);
+    }
+}
+
+static QImage readPackedRgb(const uchar *data, quint32 width, quint32 height, const PackedRgbLayout &layout,
+                            QImage *target)
+{
+    QImage image = createImage(target, width, height, QImage::Format_RGB32);
+    decodeLines(data, 4 * ((qint64(width) + 1) / 2), &layout, image, readPackedRgbLineRange);
+    return image;
+}
+
+static QImage readR8G8B8G8(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readPackedRgb(data, width, height, rgbgLayout, target);
+}
+
+static QImage readG8R8G8B8(const uchar *data, quint32 width, quint32 height, QImage *target)
+{
+    return readPackedRgb(data, width, height, grgbLayout, target);
+}
+
+// Both 10-bit layouts come out with red and blue exchanged. Exchanging the
+// masks does that in the line reader, and picks the other layout's reader.
+static QImage readA2R10G10B10(const uchar *data, const DDSHeader &dds, quint32 width, quint32 height, QImage *target)
+{
+    DDSHeader swapped = dds;
+    qSwap(swapped.pixelFormat.rBitMask, swapped.pixelFormat.bBitMask);
+    return readUnsignedImage(data, swapped, width, height, true, target);
+}
+
+// The format of the image that readLayer() returns
+static QImage::Format layerFormat(const int format, const DecodeOptions &options = DecodeOptions())
+{
+    switch (format) {
+    case FormatR8G8B8:
+    case FormatX8R8G8B8:
+    case FormatR5G6B5:
+    case FormatR3G3B2:
+    case FormatX1R5G5B5:
+    case FormatX4R4G4B4:
+    case FormatX8B8G8R8:
+    case FormatG16R16:
+    case FormatL8:
+    case FormatL16:
+    case FormatV8U8:
+    case FormatV16U16:
+    case FormatUYVY:
+    case FormatR8G8B8G8:
+    case FormatYUY2:
+    case FormatG8R8G8B8:
+    case FormatATI2:
+    case FormatR16F:
+    case FormatG16R16F:
+    case FormatR32F:
+    case FormatG32R32F:
+    case FormatCxV8U8:
+        return QImage::Format_RGB32;
+    case FormatA8R8G8B8:
+    case FormatA1R5G5B5:
+    case FormatA4R4G4B4:
+    case FormatA8:
     case FormatA8R3G3B2:
-    case FormatA2B10G10R10:
     case FormatA8B8G8R8:
-    case FormatA2R10G10B10:
     case FormatA8L8:
     case FormatA4L4:
-        return w * h * dds.pixelFormat.rgbBitCount / 8;
-    case FormatP8:
-        return 256 + w * h * 8;
+    case FormatA2R10G10B10:
+    case FormatA2B10G10R10:
     case FormatA16B16G16R16:
-        return w * h * 4 * 2;
+    case FormatL6V5U5:
+    case FormatX8L8V8U8:
+    case FormatQ8W8V8U8:
+    case FormatA2W10V10U10:
+    case FormatDXT1:
+    case FormatDXT3:
+    case FormatDXT5:
+    case FormatRXGB:
+    case FormatA16B16G16R16F:
+    case FormatA32B32G32R32F:
+    case FormatQ16W16V16U16:
+        return QImage::Format_ARGB32;
+    case FormatDXT2:
+    case FormatDXT4:
+        return QImage::Format_ARGB32_Premultiplied;
+    case FormatP8:
     case FormatA8P8:
+    case FormatP4:
+    case FormatA4P4:
+        return options.expandPalette ? QImage::Format_ARGB32 : QImage::Format_Indexed8;
+    default:
         break;
+    }
+
+    return QImage::Format_Invalid;
+}
+
+static QImage decodeLayer(const uchar *data, const DDSHeader &dds, const int format, quint32 width, quint32 height,
+                          QImage *target, const DecodeOptions &options)
+{
+    switch (format) {
+    case FormatR8G8B8:
+    case FormatX8R8G8B8:
+    case FormatR5G6B5:
+    case FormatR3G3B2:
+    case FormatX1R5G5B5:
+    case FormatX4R4G4B4:
+    case FormatX8B8G8R8:
+    case FormatG16R16:
+    case FormatL8:
+    case FormatL16:
+        return readUnsignedImage(data, dds, width, height, false, target);
+    case FormatA8R8G8B8:
+    case FormatA1R5G5B5:
+    case FormatA4R4G4B4:
+    case FormatA8:
+    case FormatA8R3G3B2:
+    case FormatA8B8G8R8:
+    case FormatA8L8:
+    case FormatA4L4:
+        return readUnsignedImage(data, dds, width, height, true, target);
+    case FormatA2R10G10B10:
+    case FormatA2B10G10R10:
+        return readA2R10G10B10(data, dds, width, height, target);
+    case FormatP8:
+    case FormatA8P8:
+        return readPalette8Image(data, width, height, options.expandPalette, target);
+    case FormatP4:
+    case FormatA4P4:
+        return readPalette4Image(data, width, height, options.expandPalette, target);
+    case FormatA16B16G16R16:
+        return readARGB16(data, width, height, target);
     case FormatV8U8:
+        return readV8U8(data, width, height, target);
     case FormatL6V5U5:
-        return w * h * 2;
+        return readL6V5U5(data, width, height, target);
     case FormatX8L8V8U8:
+        return readX8L8V8U8(data, width, height, target);
     case FormatQ8W8V8U8:
+        return readQ8W8V8U8(data, width, height, target);
     case FormatV16U16:
+        return readV16U16(data, width, height, target);
     case FormatA2W10V10U10:
-        return w * h * 4;
+        return readA2W10V10U10(data, width, height, target);
     case FormatUYVY:
+        return readUYVY(data, width, height, yuvCoefficients(options.yuvMatrix), target);
     case FormatR8G8B8G8:
+        return readR8G8B8G8(data, width, height, target);
     case FormatYUY2:
+        return readYUY2(data, width, height, yuvCoefficients(options.yuvMatrix), target);
     case FormatG8R8G8B8:
-        return w * h * 2;
+        return readG8R8G8B8(data, width, height, target);
     case FormatDXT1:
-        return ((w + 3)/4) * ((h + 3)/4) * 8;
+        return readDXT1(data, width, height, target);
     case FormatDXT2:
+        return readDXT2(data, width, height, target);
     case FormatDXT3:
+        return readDXT3(data, width, height, target);
     case FormatDXT4:
+        return readDXT4(data, width, height, target);
     case FormatDXT5:
-        return ((w + 3)/4) * ((h + 3)/4) * 16;
+        return readDXT5(data, width, height, target);
+    case FormatRXGB:
+        return readRXGB(data, width, height, target);
+    case FormatATI2:
+        return readATI2(data, width, height, target);
+    case FormatR16F:
+        return readR16F(data, width, height, target);
+    case FormatG16R16F:
+        return readRG16F(data, width, height, target);
+    case FormatA16B16G16R16F:
+        return readARGB16F(data, width, height, target);
+    case FormatR32F:
+        return readR32F(data, width, height, target);
+    case FormatG32R32F:
+        return readRG32F(data, width, height, target);
+    case FormatA32B32G32R32F:
+        return readARGB32F(data, width, height, target);
     case FormatD16Lockable:
     case FormatD32:
     case FormatD15S1:
@@ -1289,23 +2615,11 @@ static qint64 mipmapSize(const DDSHeader &dds, const int format, const int level
     case FormatIndex32:
         break;
     case FormatQ16W16V16U16:
-        return w * h * 4 * 2;
+        return readQ16W16V16U16(data, width, height, target);
     case FormatMulti2ARGB8:
         break;
-    case FormatR16F:
-        return w * h * 1 * 2;
-    case FormatG16R16F:
-        return w * h * 2 * 2;
-    case FormatA16B16G16R16F:
-        return w * h * 4 * 2;
-    case FormatR32F:
-        return w * h * 1 * 4;
-    case FormatG32R32F:
-        return w * h * 2 * 4;
-    case FormatA32B32G32R32F:
-        return w * h * 4 * 4;
     case FormatCxV8U8:
-        return w * h * 2;
+        return readCxV8U8(data, width, height, target);
     case FormatA1:
     case FormatA2B10G10R10_XR_BIAS:
     case FormatBinaryBuffer:
@@ -1313,112 +2627,993 @@ static qint64 mipmapSize(const DDSHeader &dds, const int format, const int level
         break;
     }
 
-    return 0;
-}
-
-static qint64 mipmapOffset(const DDSHeader &dds, const int format, const int level)
-{
-    qint64 result = 0;
-    for (int i = 0; i < level; ++i)
-        result += mipmapSize(dds, format, i);
-    return result;
+    return QImage();
 }
 
-static QImage readCubeMap(QDataStream &s, const DDSHeader &dds, const int fmt)
+// Decodes into target when it has the right size and format. A read that
+// fails before decoding starts leaves the caller's image as it was, but a
+// decoder that gives up partway may already have written some of its rows.
+static QImage readLayer(const uchar *data, const DDSHeader &dds, const int format, quint32 width, quint32 height,
+                        QImage *target = Q_NULLPTR, const DecodeOptions &options = DecodeOptions())
 {
-    QImage::Format format = hasAlpha(dds) ? QImage::Format_ARGB32 : QImage::Format_RGB32;
-    QImage image(4 * dds.width, 3 * dds.height, format);
-
-    image.fill(0);
+    const QImage::Format imageFormat = layerFormat(format, options);
+    if (width == 0 || height == 0 || imageFormat == QImage::Format_Invalid)
+        return QImage();
 
-    for (int i = 0; i < 6; i++) {
-        if (!(dds.caps2 & faceFlags[i]))
-            continue; // Skip face.
+    // Decoders write straight into the image they get from createImage(), so
+    // an image that can't be allocated has to fail before any of them runs
+    QImage image;
+    const bool inPlace = canDecodeInto(target, width, height, imageFormat);
+    if (inPlace) {
+        image.swap(*target);
+    } else {
+        image = QImage(width, height, imageFormat);
+        if (image.isNull()) {
+            qWarning() << "Can't allocate a" << width << "x" << height << "image";
+            return QImage();
+        }
+    }
 
-        const QImage face = readLayer(s, dds, fmt, dds.width, dds.height);
+    const QImage decoded = decodeLayer(data, dds, format, width, height, &image, options);
+    if (decoded.isNull() && inPlace)
+        target->swap(image);
+    return decoded;
+}
 
-        // Compute face offsets.
-        int offset_x = faceOffsets[i].x * dds.width;
-        int offset_y = faceOffsets[i].y * dds.height;
+// Returns the size of one row of blocks, which is a row of pixels for
+// all formats except the block-compressed ones
+static qint64 rowPitch(const DDSHeader &dds, const int format, quint32 width)
+{
+    const qint64 w = width;
 
-        // Copy face on the image.
-        for (quint32 y = 0; y < dds.height; y++) {
-            const QRgb *src = reinterpret_cast<const QRgb *>(face.scanLine(y));
-            QRgb *dst = reinterpret_cast<QRgb *>(image.scanLine(y + offset_y)) + offset_x;
-            memcpy(dst, src, sizeof(QRgb) * dds.width);
-        }
-    }
+    switch (format) {
+    case FormatR8G8B8:
+    case FormatX8R8G8B8:
+    case FormatR5G6B5:
+    case FormatR3G3B2:
+    case FormatX1R5G5B5:
+    case FormatX4R4G4B4:
+    case FormatX8B8G8R8:
+    case FormatG16R16:
+    case FormatL8:
+    case FormatL16:
+        return w * dds.pixelFormat.rgbBitCount / 8;
+    case FormatA8R8G8B8:
+    case FormatA1R5G5B5:
+    case FormatA4R4G4B4:
+    case FormatA8:
+    case FormatA8R3G3B2:
+    case FormatA2B10G10R10:
+    case FormatA8B8G8R8:
+    case FormatA2R10G10B10:
+    case FormatA8L8:
+    case FormatA4L4:
+        return w * dds.pixelFormat.rgbBitCount / 8;
+    case FormatP8:
+    case FormatA8P8:
+        return w;
+    case FormatP4:
+    case FormatA4P4:
+        return (w + 1) / 2;
+    case FormatA16B16G16R16:
+        return w * 4 * 2;
+    case FormatV8U8:
+    case FormatL6V5U5:
+        return w * 2;
+    case FormatX8L8V8U8:
+    case FormatQ8W8V8U8:
+    case FormatV16U16:
+    case FormatA2W10V10U10:
+        return w * 4;
+    case FormatUYVY:
+    case FormatR8G8B8G8:
+    case FormatYUY2:
+    case FormatG8R8G8B8:
+        return (w + 1) / 2 * 4;
+    case FormatDXT1:
+        return ((w + 3)/4) * 8;
+    case FormatDXT2:
+    case FormatDXT3:
+    case FormatDXT4:
+    case FormatDXT5:
+    case FormatRXGB:
+    case FormatATI2:
+        return ((w + 3)/4) * 16;
+    case FormatD16Lockable:
+    case FormatD32:
+    case FormatD15S1:
+    case FormatD24S8:
+    case FormatD24X8:
+    case FormatD24X4S4:
+    case FormatD16:
+    case FormatD32FLockable:
+    case FormatD24FS8:
+    case FormatD32Lockable:
+    case FormatS8Lockable:
+    case FormatVertexData:
+    case FormatIndex16:
+    case FormatIndex32:
+        break;
+    case FormatQ16W16V16U16:
+        return w * 4 * 2;
+    case FormatMulti2ARGB8:
+        break;
+    case FormatR16F:
+        return w * 1 * 2;
+    case FormatG16R16F:
+        return w * 2 * 2;
+    case FormatA16B16G16R16F:
+        return w * 4 * 2;
+    case FormatR32F:
+        return w * 1 * 4;
+    case FormatG32R32F:
+        return w * 2 * 4;
+    case FormatA32B32G32R32F:
+        return w * 4 * 4;
+    case FormatCxV8U8:
+        return w * 2;
+    case FormatA1:
+    case FormatA2B10G10R10_XR_BIAS:
+    case FormatBinaryBuffer:
+    case FormatLast:
+        break;
+    }
+
+    return 0;
+}
+
+// Palettized formats store their color table in front of every surface
+static qint64 paletteSize(const int format)
+{
+    switch (format) {
+    case FormatP8:
+    case FormatA8P8:
+        return 256 * 4;
+    case FormatP4:
+    case FormatA4P4:
+        return 16 * 4;
+    default:
+        break;
+    }
+    return 0;
+}
+
+static void blockSize(const int format, quint32 &blockWidth, quint32 &blockHeight)
+{
+    switch (format) {
+    case FormatDXT1:
+    case FormatDXT2:
+    case FormatDXT3:
+    case FormatDXT4:
+    case FormatDXT5:
+    case FormatRXGB:
+    case FormatATI2:
+        blockWidth = 4;
+        blockHeight = 4;
+        break;
+    case FormatUYVY:
+    case FormatR8G8B8G8:
+    case FormatYUY2:
+    case FormatG8R8G8B8:
+        blockWidth = 2;
+        blockHeight = 1;
+        break;
+    default:
+        blockWidth = 1;
+        blockHeight = 1;
+        break;
+    }
+}
+
+static qint64 surfaceSize(const DDSHeader &dds, const int format, quint32 width, quint32 height)
+{
+    quint32 blockWidth;
+    quint32 blockHeight;
+    blockSize(format, blockWidth, blockHeight);
+
+    const qint64 pitch = rowPitch(dds, format, width);
+    if (pitch <= 0)
+        return 0;
+    return paletteSize(format) + pitch * ((qint64(height) + blockHeight - 1) / blockHeight);
+}
+
+// One face of a cube map and the cell of the cross it is decoded into
+struct CubeFace
+{
+    const uchar *data;
+    const DDSHeader *dds;
+    int format;
+    quint32 width;
+    quint32 height;
+    DecodeOptions options;
+    uchar *cell;
+    qint64 bytesPerLine;
+};
+
+// The face is decoded through an image that uses the cell as its buffer,
+// the decoders write into it in place when its format is the one they
+// produce
+static void decodeCubeFace(CubeFace &face)
+{
+    const QImage::Format format = layerFormat(face.format, face.options);
+    QImage view;
+    if (format != QImage::Format_Invalid)
+        view = QImage(face.cell, face.width, face.height, face.bytesPerLine, format);
+
+    const QImage image = readLayer(face.data, *face.dds, face.format, face.width, face.height, &view, face.options);
+    if (!image.isNull() && image.constBits() == face.cell)
+        return;
+
+    for (quint32 y = 0; y < face.height; y++) {
+        uchar *dst = face.cell + y * face.bytesPerLine;
+        if (image.isNull())
+            memset(dst, 0, sizeof(QRgb) * face.width);
+        else
+            memcpy(dst, image.constScanLine(y), sizeof(QRgb) * face.width);
+    }
+}
+
+static QImage readCubeMap(const uchar *const faces[6], const DDSHeader &dds, const int fmt,
+                          quint32 width, quint32 height, QImage *target = Q_NULLPTR,
+                          const DecodeOptions &options = DecodeOptions())
+{
+    QImage::Format format = hasAlpha(dds) ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+    QImage image = createImage(target, 4 * width, 3 * height, format);
+    if (image.isNull()) {
+        qWarning() << "Can't allocate a" << 4 * width << "x" << 3 * height << "image";
+        return image;
+    }
+
+    uchar *bits = image.bits();
+    const qint64 bytesPerLine = image.bytesPerLine();
+
+    // Faces are copied as 32-bit pixels, so palettes are always expanded
+    CubeFace face;
+    face.dds = &dds;
+    face.format = fmt;
+    face.width = width;
+    face.height = height;
+    face.options = options;
+    face.options.expandPalette = true;
+    face.bytesPerLine = bytesPerLine;
+
+    bool used[3][4] = {};
+    QVector<CubeFace> decoded;
+    for (int i = 0; i < 6; i++) {
+        if (!faces[i])
+            continue; // Skip face.
+
+        face.data = faces[i];
+        face.cell = bits + faceOffsets[i].y * height * bytesPerLine + faceOffsets[i].x * width * sizeof(QRgb);
+        decoded.append(face);
+        used[faceOffsets[i].y][faceOffsets[i].x] = true;
+    }
+
+    // Only the cells that no face covers need clearing
+    for (int row = 0; row < 3; row++) {
+        for (int column = 0; column < 4; column++) {
+            if (used[row][column])
+                continue;
+            uchar *cell = bits + row * height * bytesPerLine + column * width * sizeof(QRgb);
+            for (quint32 y = 0; y < height; y++)
+                memset(cell + y * bytesPerLine, 0, sizeof(QRgb) * width);
+        }
+    }
+
+    if (QThreadPool::globalInstance()->maxThreadCount() > 1) {
+        QtConcurrent::blockingMap(decoded, decodeCubeFace);
+    } else {
+        for (int i = 0; i < decoded.size(); i++)
+            decodeCubeFace(decoded[i]);
+    }
+
+    return image;
+}
+
+// Gives the decoders access to a byte range of the device. QFile ranges
+// are memory mapped and QBuffer ranges point straight into the buffer, so
+// no copy is made; other devices fall back to a plain read.
+class DataRange
+{
+public:
+    DataRange() : m_file(Q_NULLPTR), m_mapped(Q_NULLPTR), m_data(Q_NULLPTR) {}
+    ~DataRange();
+
+    bool load(QIODevice *device, qint64 offset, qint64 size);
+    const uchar *data() const { return m_data; }
+
+private:
+    Q_DISABLE_COPY(DataRange)
+
+    QFile *m_file;
+    uchar *m_mapped;
+    QByteArray m_buffer;
+    const uchar *m_data;
+};
+
+DataRange::~DataRange()
+{
+    if (m_mapped)
+        m_file->unmap(m_mapped);
+}
+
+// A QByteArray can't hold more than INT_MAX bytes, copies of larger ranges
+// would be truncated
+static bool fitsByteArray(qint64 size)
+{
+    if (size >= 0 && size <= std::numeric_limits<int>::max())
+        return true;
+
+    qWarning() << "Can't copy" << size << "bytes into a single buffer";
+    return false;
+}
+
+// Reads exactly size bytes, waiting for sequential devices to deliver more
+static bool readFully(QIODevice *device, char *data, qint64 size)
+{
+    while (size > 0) {
+        const qint64 read = device->read(data, size);
+        if (read < 0 || (read == 0 && !device->waitForReadyRead(-1)))
+            return false;
+        data += read;
+        size -= read;
+    }
+    return true;
+}
+
+static bool skipBytes(QIODevice *device, qint64 size)
+{
+    char buffer[4096];
+    while (size > 0) {
+        const qint64 chunk = qMin<qint64>(size, sizeof(buffer));
+        if (!readFully(device, buffer, chunk))
+            return false;
+        size -= chunk;
+    }
+    return true;
+}
+
+// Sequential devices must already be positioned at offset
+bool DataRange::load(QIODevice *device, qint64 offset, qint64 size)
+{
+    if (device->isSequential()) {
+        if (!fitsByteArray(size))
+            return false;
+        m_buffer.resize(int(size));
+        if (!readFully(device, m_buffer.data(), size))
+            return false;
+        m_data = reinterpret_cast<const uchar *>(m_buffer.constData());
+        return true;
+    }
+
+    if (QFile *file = qobject_cast<QFile *>(device)) {
+        m_mapped = file->map(offset, size);
+        if (m_mapped) {
+            m_file = file;
+            m_data = m_mapped;
+            return true;
+        }
+    } else if (QBuffer *buffer = qobject_cast<QBuffer *>(device)) {
+        const QByteArray &bytes = buffer->data();
+        if (offset + size > bytes.size())
+            return false;
+        m_data = reinterpret_cast<const uchar *>(bytes.constData()) + offset;
+        return true;
+    }
+
+    if (!fitsByteArray(size) || !device->seek(offset))
+        return false;
+
+    m_buffer = device->read(size);
+    if (m_buffer.size() != size)
+        return false;
+    m_data = reinterpret_cast<const uchar *>(m_buffer.constData());
+    return true;
+}
+
+// Tells the OS that a byte range of the file will be read soon, so it can
+// be pulled into the page cache while we are busy decoding.
+static void adviseWillNeed(QFile *file, qint64 offset, qint64 size)
+{
+#if defined(Q_OS_UNIX) && defined(_POSIX_ADVISORY_INFO) && _POSIX_ADVISORY_INFO > 0
+    const int fd = file->handle();
+    if (fd >= 0)
+        ::posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+#else
+    Q_UNUSED(file);
+    Q_UNUSED(offset);
+    Q_UNUSED(size);
+#endif
+}
+
+struct MappedFormat
+{
+    Format format;
+    QImage::Format imageFormat;
+    int bytesPerPixel;
+};
+
+// Formats whose pixels are stored exactly like the matching QImage format.
+// X8R8G8B8 isn't one of them, RGB32 needs the X byte to be 0xff and files
+// usually leave it zero.
+static const MappedFormat mappedFormats[] = {
+    { FormatA8R8G8B8, QImage::Format_ARGB32, 4 },
+    { FormatR5G6B5, QImage::Format_RGB16, 2 },
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    { FormatL8, QImage::Format_Grayscale8, 1 },
+    { FormatA8, QImage::Format_Alpha8, 1 }
+#endif
+};
+static const size_t mappedFormatsSize = sizeof(mappedFormats)/sizeof(MappedFormat);
+
+static void deleteMappedFile(void *file)
+{
+    delete static_cast<QFile *>(file);
+}
+
+// Returns the mapping for a texture whose bytes can be used as a QImage as
+// they are, or null
+static const MappedFormat *mappedFormat(const DDSSubresource &texture, const int format)
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    const MappedFormat *mapped = Q_NULLPTR;
+    for (size_t i = 0; i < mappedFormatsSize; ++i) {
+        if (mappedFormats[i].format == format)
+            mapped = &mappedFormats[i];
+    }
+    if (!mapped || texture.offset % 4 != 0)
+        return Q_NULLPTR;
+
+    const qint64 pitch = qint64(texture.width) * mapped->bytesPerPixel;
+    if (pitch % 4 != 0 || pitch > INT_MAX || texture.height > INT_MAX)
+        return Q_NULLPTR;
+    return mapped;
+#else
+    Q_UNUSED(texture);
+    Q_UNUSED(format);
+    return Q_NULLPTR;
+#endif
+}
+
+// Returns an image that uses the file contents as its pixel buffer. The
+// file is opened once more so the mapping outlives the handler's device.
+static QImage mapTexture(const QString &fileName, const DDSSubresource &texture, const int format)
+{
+    const MappedFormat *mapped = mappedFormat(texture, format);
+    if (!mapped || fileName.isEmpty())
+        return QImage();
+
+    const qint64 pitch = qint64(texture.width) * mapped->bytesPerPixel;
+
+    QFile *file = new QFile(fileName);
+    uchar *bits = Q_NULLPTR;
+    if (file->open(QIODevice::ReadOnly))
+        bits = file->map(texture.offset, pitch * texture.height);
+    if (!bits) {
+        delete file;
+        return QImage();
+    }
+
+    const uchar *constBits = bits;
+    return QImage(constBits, texture.width, texture.height, pitch, mapped->imageFormat,
+                  deleteMappedFile, file);
+}
+
+static QByteArray formatName(int format)
+{
+    for (size_t i = 0; i < formatNamesSize; ++i) {
+        if (formatNames[i].format == format)
+            return formatNames[i].name;
+    }
+
+    return formatNames[0].name;
+}
+
+static int formatByName(const QByteArray &name)
+{
+    const QByteArray loweredName = name.toLower();
+    for (size_t i = 0; i < formatNamesSize; ++i) {
+        if (QByteArray(formatNames[i].name).toLower() == loweredName)
+            return formatNames[i].format;
+    }
+
+    return FormatUnknown;
+}
+
+// Size of the QImage that readLayer() allocates
+static qint64 imageSize(int format, quint32 width, quint32 height, const DecodeOptions &options = DecodeOptions())
+{
+    if (options.expandPalette)
+        return qint64(width) * height * sizeof(QRgb);
+
+    switch (format) {
+    case FormatP8:
+    case FormatA8P8:
+    case FormatP4:
+    case FormatA4P4:
+        return ((qint64(width) + 3) & ~3) * height + 256 * sizeof(QRgb);
+    default:
+        return qint64(width) * height * sizeof(QRgb);
+    }
+}
+
+// Bytes that all handlers are decoding into at the same time
+struct ProcessBudget
+{
+    ProcessBudget() : limit(0), used(0) {}
+
+    QMutex mutex;
+    qint64 limit;
+    qint64 used;
+};
+
+Q_GLOBAL_STATIC(ProcessBudget, processBudget)
+
+class MemoryReservation
+{
+public:
+    MemoryReservation() : m_size(0) {}
+    ~MemoryReservation();
+
+    bool reserve(qint64 size);
+
+private:
+    Q_DISABLE_COPY(MemoryReservation)
+
+    qint64 m_size;
+};
+
+MemoryReservation::~MemoryReservation()
+{
+    if (m_size == 0)
+        return;
+
+    ProcessBudget *budget = processBudget();
+    QMutexLocker locker(&budget->mutex);
+    budget->used -= m_size;
+}
+
+bool MemoryReservation::reserve(qint64 size)
+{
+    ProcessBudget *budget = processBudget();
+    QMutexLocker locker(&budget->mutex);
+    if (budget->limit > 0 && budget->used + size > budget->limit)
+        return false;
+
+    budget->used += size;
+    m_size += size;
+    return true;
+}
+
+// State shared by the fetch and decode stages of readAsync()
+struct AsyncRead
+{
+    QFutureInterface<QImage> result;
+    QString fileName;
+    QByteArray bytes;
+    qint64 offset;
+    qint64 size;
+    DDSHeader header;
+    int format;
+    quint32 width;
+    quint32 height;
+    DecodeOptions options;
+    QSharedPointer<MemoryReservation> reservation;
+};
+
+// Fetches use their own small pool so that slow reads never hold up
+// threads that could be decoding. A couple of reads in flight keep the
+// disk busy, more only make them compete for it.
+struct IoThreadPool
+{
+    IoThreadPool() { pool.setMaxThreadCount(2); }
+
+    QThreadPool pool;
+};
+Q_GLOBAL_STATIC(IoThreadPool, ioThreadPool)
+
+static void decodeAsync(AsyncRead request)
+{
+    QImage image;
+    if (!request.result.isCanceled() && request.offset + request.size <= request.bytes.size()) {
+        const uchar *data = reinterpret_cast<const uchar *>(request.bytes.constData()) + request.offset;
+        image = readLayer(data, request.header, request.format, request.width, request.height,
+                          Q_NULLPTR, request.options);
+    }
+
+    request.result.reportResult(image);
+    request.result.reportFinished();
+}
+
+static void fetchAsync(AsyncRead request)
+{
+    if (request.result.isCanceled()) {
+        request.result.reportResult(QImage());
+        request.result.reportFinished();
+        return;
+    }
+
+    // A texture that doesn't fit leaves the buffer empty and decodes to a
+    // null image
+    QFile file(request.fileName);
+    if (!fitsByteArray(request.size))
+        request.bytes.clear();
+    else if (file.open(QIODevice::ReadOnly) && file.seek(request.offset))
+        request.bytes = file.read(request.size);
+    else
+        qWarning() << "Can't read" << request.fileName << ":" << file.errorString();
+    request.offset = 0;
+
+    QtConcurrent::run(QThreadPool::globalInstance(), decodeAsync, request);
+}
+
+// One level of readMipmaps(), cube maps use all six faces
+struct MipLevel
+{
+    const uchar *faces[6];
+    const DDSHeader *header;
+    int format;
+    quint32 width;
+    quint32 height;
+    DecodeOptions options;
+    QImage image;
+};
+
+static void decodeMipLevel(MipLevel &level)
+{
+    if (isCubeMap(*level.header)) {
+        level.image = readCubeMap(level.faces, *level.header, level.format, level.width, level.height,
+                                  Q_NULLPTR, level.options);
+    } else {
+        level.image = readLayer(level.faces[0], *level.header, level.format, level.width, level.height,
+                                Q_NULLPTR, level.options);
+    }
+}
+
+QDDSHandler::QDDSHandler() :
+    m_header(),
+    m_format(FormatA8R8G8B8),
+    m_header10(),
+    m_currentImage(0),
+    m_mipmapCount(0),
+    m_faceCount(0),
+    m_arraySize(0),
+    m_depth(0),
+    m_prefetchDepth(1),
+    m_memoryBudget(0),
+    m_memoryBudgetPolicy(FailOverBudget),
+    m_yuvMatrix(YuvMatrixBt601),
+    m_expandPalettes(false),
+    m_streamPos(0),
+    m_mapImages(false),
+    m_scanState(ScanNotScanned)
+{
+}
+
+QByteArray QDDSHandler::name() const
+{
+    return QByteArrayLiteral("dds");
+}
+
+bool QDDSHandler::canRead() const
+{
+    if (m_scanState == ScanNotScanned && !canRead(device()))
+        return false;
+
+    if (m_scanState != ScanError) {
+        setFormat(QByteArrayLiteral("dds"));
+        return true;
+    }
+
+    return false;
+}
+
+bool QDDSHandler::read(QImage *outImage)
+{
+    if (!ensureScanned())
+        return false;
+
+    // A mapped image needs no decoding memory, so try it before the budget
+    QFile *file = qobject_cast<QFile *>(device());
+    if (m_mapImages && file && !file->isSequential() && !isCubeMap(m_header)) {
+        const int index = subresourceIndex(m_currentImage, 0, 0, 0);
+        if (index >= 0 && m_subresources.at(index).size > 0) {
+            const QImage image = mapTexture(file->fileName(), m_subresources.at(index), m_format);
+            if (!image.isNull()) {
+                *outImage = image;
+                return true;
+            }
+        }
+    }
+
+    MemoryReservation reservation;
+    const int level = levelWithinBudget(m_currentImage, -1, reservation);
+    if (level < 0)
+        return false;
+
+    QImage image;
+    if (isCubeMap(m_header)) {
+        DataRange faces[6];
+        const uchar *faceData[6];
+        quint32 width = 0;
+        quint32 height = 0;
+        for (int i = 0; i < 6; i++) {
+            faceData[i] = Q_NULLPTR;
+            const int index = subresourceIndex(level, i, 0, 0);
+            if (index < 0)
+                continue; // Skip face.
+
+            const DDSSubresource &face = m_subresources.at(index);
+            if (face.size <= 0 || !loadSubresource(faces[i], face))
+                return false;
+            faceData[i] = faces[i].data();
+            width = face.width;
+            height = face.height;
+        }
+        prefetch(level + 1);
+        image = readCubeMap(faceData, m_header, m_format, width, height, outImage, decodeOptions(*this));
+    } else {
+        const int index = subresourceIndex(level, 0, 0, 0);
+        if (index < 0)
+            return false;
+
+        const DDSSubresource &texture = m_subresources.at(index);
+        if (texture.size <= 0)
+            return false;
+
+        // Fetch the whole subresource at once, decoders work on the raw bytes
+        DataRange data;
+        if (!loadSubresource(data, texture))
+            return false;
+
+        prefetch(level + 1);
+        image = readLayer(data.data(), m_header, m_format, texture.width, texture.height, outImage, decodeOptions(*this));
+    }
+
+    bool ok = !image.isNull();
+    if (ok)
+        *outImage = image;
+    return ok;
+}
+
+// Collects the strips of readRows() into a single image
+class RowsSink : public DDSStripSink
+{
+public:
+    RowsSink(quint32 first, quint32 count) : m_first(first), m_count(count) {}
+
+    bool writeStrip(const QImage &strip, int y) override;
+    QImage image() const { return m_image; }
+
+private:
+    quint32 m_first;
+    quint32 m_count;
+    QImage m_image;
+};
+
+bool RowsSink::writeStrip(const QImage &strip, int y)
+{
+    if (m_image.isNull()) {
+        m_image = QImage(strip.width(), m_count, strip.format());
+        if (m_image.isNull())
+            return false;
+        m_image.setColorTable(strip.colorTable());
+    }
+
+    const quint32 first = qMax<quint32>(m_first, y);
+    const quint32 last = qMin<quint32>(m_first + m_count, y + strip.height());
+    for (quint32 row = first; row < last; row++)
+        memcpy(m_image.scanLine(row - m_first), strip.constScanLine(row - y), size_t(m_image.bytesPerLine()));
+    return true;
+}
+
+bool QDDSHandler::readStrips(DDSStripSink *sink, int stripHeight, int level, int face)
+{
+    if (!sink || !ensureScanned())
+        return false;
+
+    const int index = subresourceIndex(level, face, 0, 0);
+    if (index < 0)
+        return false;
+
+    const DDSSubresource texture = m_subresources.at(index);
+    return decodeStrips(sink, texture, 0, texture.height, stripHeight);
+}
+
+// Decodes the rows [y, y + height) without decoding the rest of the level
+QImage QDDSHandler::readRows(int y, int height, int level, int face)
+{
+    if (!ensureScanned() || y < 0 || height <= 0)
+        return QImage();
+
+    const int index = subresourceIndex(level, face, 0, 0);
+    if (index < 0)
+        return QImage();
+
+    const DDSSubresource texture = m_subresources.at(index);
+    if (quint32(y) >= texture.height)
+        return QImage();
 
-    return image;
+    // The rows are collected into an image of their own, which counts against
+    // the budgets together with the strips
+    const quint32 count = qMin<quint32>(height, texture.height - y);
+    const qint64 size = imageSize(m_format, texture.width, count, decodeOptions(*this));
+    RowsSink sink(y, count);
+    if (!decodeStrips(&sink, texture, y, y + count, count, size))
+        return QImage();
+    return sink.image();
 }
 
-static QByteArray formatName(int format)
+// Returns what read() gives for every level. The bytes of all levels are
+// loaded with a single read or mapping and the levels are decoded at the
+// same time. The whole chain counts as one decode against the budgets.
+// When some level gets mapped, or the chain is over budget under
+// FallBackToSmallerMipmap, the levels are read() one at a time instead.
+QVector<QImage> QDDSHandler::readMipmaps()
 {
-    for (size_t i = 0; i < formatNamesSize; ++i) {
-        if (formatNames[i].format == format)
-            return formatNames[i].name;
+    if (!ensureScanned())
+        return QVector<QImage>();
+
+    QFile *file = qobject_cast<QFile *>(device());
+    const bool mapImages = m_mapImages && file && !file->isSequential() && !isCubeMap(m_header);
+    bool mapped = false;
+    const int faces = isCubeMap(m_header) ? 6 : 1;
+    qint64 first = -1;
+    qint64 end = 0;
+    qint64 size = 0;
+    for (int level = 0; level < m_mipmapCount; level++) {
+        for (int face = 0; face < faces; face++) {
+            const int index = subresourceIndex(level, face, 0, 0);
+            if (index < 0)
+                continue;
+
+            const DDSSubresource &subresource = m_subresources.at(index);
+            if (subresource.size <= 0)
+                return QVector<QImage>();
+            first = first < 0 ? subresource.offset : qMin(first, subresource.offset);
+            end = qMax(end, subresource.offset + subresource.size);
+            mapped = mapped || (mapImages && mappedFormat(subresource, m_format));
+        }
+        size += decodedSize(level, -1);
+    }
+    if (first < 0)
+        return QVector<QImage>();
+    if (mapped)
+        return readEachMipmap();
+
+    MemoryReservation reservation;
+    if ((m_memoryBudget > 0 && size > m_memoryBudget) || !reservation.reserve(size)) {
+        if (m_memoryBudgetPolicy == FallBackToSmallerMipmap)
+            return readEachMipmap();
+        qWarning() << "Decoding all levels exceeds the memory budget";
+        return QVector<QImage>();
     }
 
-    return formatNames[0].name;
-}
-
-static int formatByName(const QByteArray &name)
-{
-    const QByteArray loweredName = name.toLower();
-    for (size_t i = 0; i < formatNamesSize; ++i) {
-        if (QByteArray(formatNames[i].name).toLower() == loweredName)
-            return formatNames[i].format;
+    DDSSubresource chain;
+    chain.offset = first;
+    chain.size = end - first;
+    DataRange data;
+    if (!loadSubresource(data, chain))
+        return QVector<QImage>();
+
+    QVector<MipLevel> levels(m_mipmapCount);
+    for (int level = 0; level < m_mipmapCount; level++) {
+        MipLevel &mip = levels[level];
+        mip.header = &m_header;
+        mip.format = m_format;
+        mip.options = decodeOptions(*this);
+        mip.width = 0;
+        mip.height = 0;
+        for (int face = 0; face < 6; face++) {
+            mip.faces[face] = Q_NULLPTR;
+            const int index = face < faces ? subresourceIndex(level, face, 0, 0) : -1;
+            if (index < 0)
+                continue; // Skip face.
+
+            const DDSSubresource &subresource = m_subresources.at(index);
+            mip.faces[face] = data.data() + (subresource.offset - first);
+            mip.width = subresource.width;
+            mip.height = subresource.height;
+        }
     }
 
-    return FormatUnknown;
-}
+    QtConcurrent::blockingMap(levels, decodeMipLevel);
 
-QDDSHandler::QDDSHandler() :
-    m_header(),
-    m_format(FormatA8R8G8B8),
-    m_header10(),
-    m_currentImage(0),
-    m_scanState(ScanNotScanned)
-{
+    QVector<QImage> images;
+    images.reserve(m_mipmapCount);
+    for (int level = 0; level < m_mipmapCount; level++) {
+        if (levels.at(level).image.isNull())
+            return QVector<QImage>();
+        images.append(levels.at(level).image);
+    }
+    return images;
 }
 
-QByteArray QDDSHandler::name() const
+QVector<QImage> QDDSHandler::readEachMipmap()
 {
-    return QByteArrayLiteral("dds");
+    const int current = m_currentImage;
+    QVector<QImage> images;
+    images.reserve(m_mipmapCount);
+    for (int level = 0; level < m_mipmapCount; level++) {
+        m_currentImage = level;
+        QImage image;
+        if (!read(&image)) {
+            images.clear();
+            break;
+        }
+        images.append(image);
+    }
+    m_currentImage = current;
+    return images;
 }
 
-bool QDDSHandler::canRead() const
+// Decodes the block rows that cover [first, last) in strips of about
+// stripHeight pixel rows. Only one strip is loaded and decoded at a time, so
+// the working memory doesn't depend on the size of the texture. The budgets
+// cover that working set plus the sinkSize bytes the sink itself allocates.
+bool QDDSHandler::decodeStrips(DDSStripSink *sink, const DDSSubresource &texture,
+                               quint32 first, quint32 last, int stripHeight, qint64 sinkSize)
 {
-    if (m_scanState == ScanNotScanned && !canRead(device()))
+    if (texture.size <= 0)
         return false;
 
-    if (m_scanState != ScanError) {
-        setFormat(QByteArrayLiteral("dds"));
-        return true;
-    }
-
-    return false;
-}
+    const quint32 blockHeight = texture.blockHeight;
+    const quint32 blockRows = qMax<quint32>(1, (quint32(qMax(1, stripHeight)) + blockHeight - 1) / blockHeight);
+    const quint32 rows = blockRows * blockHeight;
+    first -= first % blockHeight;
 
-bool QDDSHandler::read(QImage *outImage)
-{
-    if (!ensureScanned() || device()->isSequential())
+    MemoryReservation reservation;
+    const qint64 stripSize = imageSize(m_format, texture.width, qMin(rows, texture.height), decodeOptions(*this))
+            + sinkSize;
+    if ((m_memoryBudget > 0 && stripSize > m_memoryBudget) || !reservation.reserve(stripSize)) {
+        qWarning() << "Decoding a strip of" << rows << "rows exceeds the memory budget";
         return false;
+    }
 
-    qint64 pos = headerSize + mipmapOffset(m_header, m_format, m_currentImage);
-    if (!device()->seek(pos))
+    // Palette formats keep their color table in front of the first row
+    const qint64 palette = paletteSize(m_format);
+    const qint64 stripBytes = qint64((qMin(rows, texture.height) + blockHeight - 1) / blockHeight) * texture.rowPitch;
+    if (palette > 0 && !fitsByteArray(palette + stripBytes))
         return false;
-    QDataStream s(device());
-    s.setByteOrder(QDataStream::LittleEndian);
 
-    QImage image = isCubeMap(m_header) ?
-                readCubeMap(s, m_header, m_format) :
-                readTexture(s, m_header, m_format, m_currentImage);
+    QByteArray bytes;
+    if (palette > 0) {
+        DDSSubresource colors = texture;
+        colors.size = palette;
+        DataRange data;
+        if (!loadSubresource(data, colors))
+            return false;
+        bytes = QByteArray(reinterpret_cast<const char *>(data.data()), int(palette));
+    }
+
+    for (quint32 y = first; y < last; y += rows) {
+        const quint32 height = qMin(rows, texture.height - y);
+
+        DDSSubresource strip = texture;
+        strip.offset = texture.offset + palette + qint64(y / blockHeight) * texture.rowPitch;
+        strip.size = qint64((height + blockHeight - 1) / blockHeight) * texture.rowPitch;
+        strip.height = height;
+
+        DataRange data;
+        if (!loadSubresource(data, strip))
+            return false;
+
+        QImage image;
+        if (palette > 0) {
+            bytes.resize(int(palette));
+            bytes.append(reinterpret_cast<const char *>(data.data()), int(strip.size));
+            image = readLayer(reinterpret_cast<const uchar *>(bytes.constData()), m_header, m_format,
+                              texture.width, height, Q_NULLPTR, decodeOptions(*this));
+        } else {
+            image = readLayer(data.data(), m_header, m_format, texture.width, height, Q_NULLPTR,
+                              decodeOptions(*this));
+        }
 
-    bool ok = s.status() == QDataStream::Ok && !image.isNull();
-    if (ok)
-        *outImage = image;
-    return ok;
+        if (image.isNull() || !sink->writeStrip(image, int(y)))
+            return false;
+    }
+
+    return true;
 }
 
 bool QDDSHandler::write(const QImage &outImage)
@@ -1491,6 +3686,8 @@ QVariant QDDSHandler::option(QImageIOHandler::ImageOption option) const
         return formatName(m_format);
     case QImageIOHandler::SupportedSubTypes:
         return QVariant::fromValue(QList<QByteArray>() << formatName(FormatA8R8G8B8));
+    case QImageIOHandler::ImageFormat:
+        return imageFormat();
     default:
         break;
     }
@@ -1512,7 +3709,24 @@ bool QDDSHandler::supportsOption(QImageIOHandler::ImageOption option) const
 {
     return (option == QImageIOHandler::Size)
             || (option == QImageIOHandler::SubType)
-            || (option == QImageIOHandler::SupportedSubTypes);
+            || (option == QImageIOHandler::SupportedSubTypes)
+            || (option == QImageIOHandler::ImageFormat);
+}
+
+// Lets callers allocate an image that read() can decode into in place
+QImage::Format QDDSHandler::imageFormat() const
+{
+    if (isCubeMap(m_header))
+        return hasAlpha(m_header) ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+
+    const int index = subresourceIndex(m_currentImage, 0, 0, 0);
+    QFile *file = qobject_cast<QFile *>(device());
+    if (m_mapImages && file && !file->isSequential() && index >= 0) {
+        if (const MappedFormat *mapped = mappedFormat(m_subresources.at(index), m_format))
+            return mapped->imageFormat;
+    }
+
+    return layerFormat(m_format, decodeOptions(*this));
 }
 
 int QDDSHandler::imageCount() const
@@ -1532,6 +3746,173 @@ bool QDDSHandler::jumpToImage(int imageNumber)
     return true;
 }
 
+int QDDSHandler::faceCount() const
+{
+    if (!ensureScanned())
+        return 0;
+
+    return m_faceCount;
+}
+
+int QDDSHandler::arraySize() const
+{
+    if (!ensureScanned())
+        return 0;
+
+    return m_arraySize;
+}
+
+int QDDSHandler::depth(int level) const
+{
+    if (!ensureScanned() || level < 0 || level >= m_mipmapCount)
+        return 0;
+
+    return qMax<quint32>(1, m_depth >> level);
+}
+
+// Describes where a subresource is stored without reading it. For palette
+// formats the color table is included at the start of the byte range.
+DDSSubresource QDDSHandler::subresource(int level, int face, int arraySlice, int depthSlice) const
+{
+    if (!ensureScanned())
+        return DDSSubresource();
+
+    const int index = subresourceIndex(level, face, arraySlice, depthSlice);
+    if (index < 0)
+        return DDSSubresource();
+
+    return m_subresources.at(index);
+}
+
+// Decodes a single subresource on the thread pool. Unlike read(), a cube map
+// gives the one face asked for rather than the cross of all six.
+QFuture<QImage> QDDSHandler::readAsync(int level, int face, int arraySlice, int depthSlice)
+{
+    AsyncRead request;
+    request.result.reportStarted();
+    QFuture<QImage> future = request.result.future();
+
+    request.reservation = QSharedPointer<MemoryReservation>(new MemoryReservation);
+    if (ensureScanned())
+        level = levelWithinBudget(level, face, *request.reservation);
+
+    const int index = level >= 0 ? subresourceIndex(level, face, arraySlice, depthSlice) : -1;
+    if (index < 0 || m_subresources.at(index).size <= 0) {
+        request.result.reportResult(QImage());
+        request.result.reportFinished();
+        return future;
+    }
+
+    const DDSSubresource &texture = m_subresources.at(index);
+    request.offset = texture.offset;
+    request.size = texture.size;
+    request.header = m_header;
+    request.format = m_format;
+    request.options = decodeOptions(*this);
+    request.width = texture.width;
+    request.height = texture.height;
+
+    // Files are reopened on the I/O pool, buffers share their data and any
+    // other device has to be read here, on the thread that owns it
+    QFile *file = qobject_cast<QFile *>(device());
+    if (file && !file->isSequential() && !file->fileName().isEmpty()) {
+        request.fileName = file->fileName();
+        QtConcurrent::run(&ioThreadPool()->pool, fetchAsync, request);
+        return future;
+    }
+
+    // A texture that doesn't fit leaves the buffer empty and decodes to a
+    // null image
+    if (device()->isSequential()) {
+        DataRange data;
+        if (fitsByteArray(texture.size) && loadSubresource(data, texture))
+            request.bytes = QByteArray(reinterpret_cast<const char *>(data.data()), int(texture.size));
+        request.offset = 0;
+    } else if (QBuffer *buffer = qobject_cast<QBuffer *>(device())) {
+        request.bytes = buffer->data();
+    } else if (fitsByteArray(texture.size) && device()->seek(texture.offset)) {
+        request.bytes = device()->read(texture.size);
+        request.offset = 0;
+    }
+
+    QtConcurrent::run(QThreadPool::globalInstance(), decodeAsync, request);
+    return future;
+}
+
+// A budget of 0 means no limit
+void QDDSHandler::setMemoryBudget(qint64 bytes, MemoryBudgetPolicy policy)
+{
+    m_memoryBudget = qMax<qint64>(0, bytes);
+    m_memoryBudgetPolicy = policy;
+}
+
+qint64 QDDSHandler::memoryBudget() const
+{
+    return m_memoryBudget;
+}
+
+QDDSHandler::MemoryBudgetPolicy QDDSHandler::memoryBudgetPolicy() const
+{
+    return m_memoryBudgetPolicy;
+}
+
+// Limits the memory of all decodes that run at the same time, 0 means no limit
+void QDDSHandler::setProcessMemoryBudget(qint64 bytes)
+{
+    ProcessBudget *budget = processBudget();
+    QMutexLocker locker(&budget->mutex);
+    budget->limit = qMax<qint64>(0, bytes);
+}
+
+qint64 QDDSHandler::processMemoryBudget()
+{
+    ProcessBudget *budget = processBudget();
+    QMutexLocker locker(&budget->mutex);
+    return budget->limit;
+}
+
+void QDDSHandler::setPrefetchDepth(int depth)
+{
+    m_prefetchDepth = qMax(0, depth);
+}
+
+int QDDSHandler::prefetchDepth() const
+{
+    return m_prefetchDepth;
+}
+
+// Coefficients used for the UYVY and YUY2 formats
+void QDDSHandler::setYuvMatrix(YuvMatrix matrix)
+{
+    m_yuvMatrix = matrix;
+}
+
+QDDSHandler::YuvMatrix QDDSHandler::yuvMatrix() const
+{
+    return m_yuvMatrix;
+}
+
+// Decodes P8 and P4 images straight to ARGB32 instead of Indexed8
+void QDDSHandler::setPaletteExpansionEnabled(bool enabled)
+{
+    m_expandPalettes = enabled;
+}
+
+bool QDDSHandler::isPaletteExpansionEnabled() const
+{
+    return m_expandPalettes;
+}
+
+void QDDSHandler::setImageMappingEnabled(bool enabled)
+{
+    m_mapImages = enabled;
+}
+
+bool QDDSHandler::isImageMappingEnabled() const
+{
+    return m_mapImages;
+}
+
 bool QDDSHandler::canRead(QIODevice *device)
 {
     if (!device) {
@@ -1539,12 +3920,18 @@ bool QDDSHandler::canRead(QIODevice *device)
         return false;
     }
 
-    if (device->isSequential())
-        return false;
-
     return device->peek(4) == QByteArrayLiteral("DDS ");
 }
 
+// Sequential devices may deliver the headers in pieces, so wait until
+// enough bytes are buffered or the stream ends
+static QByteArray peekHeader(QIODevice *device, qint64 size)
+{
+    while (device->bytesAvailable() < size && device->waitForReadyRead(-1)) {
+    }
+    return device->peek(size);
+}
+
 bool QDDSHandler::ensureScanned() const
 {
     if (m_scanState != ScanNotScanned)
@@ -1555,21 +3942,41 @@ bool QDDSHandler::ensureScanned() const
     QDDSHandler *that = const_cast<QDDSHandler *>(this);
     that->m_format = FormatUnknown;
 
-    if (device()->isSequential()) {
-        qWarning() << "Sequential devices are not supported";
-        return false;
+    if (that->loadCachedLayout()) {
+        m_scanState = ScanSuccess;
+        return true;
     }
 
-    qint64 oldPos = device()->pos();
-    device()->seek(0);
+    // Both headers are parsed from a single peek, so the device doesn't have
+    // to be seeked. Sequential devices are consumed from their current
+    // position and can't be rewound, the DX10 header is only waited for
+    // when the first one announces it.
+    const bool sequential = device()->isSequential();
+    QByteArray bytes;
+    if (sequential) {
+        bytes = peekHeader(device(), headerSize);
+        if (bytes.size() == headerSize
+                && qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(bytes.constData()) + fourCCOffset) == dx10Magic) {
+            bytes = peekHeader(device(), headerSize + header10Size);
+        }
+    } else if (device()->pos() == 0) {
+        bytes = device()->peek(headerSize + header10Size);
+    } else {
+        const qint64 oldPos = device()->pos();
+        device()->seek(0);
+        bytes = device()->read(headerSize + header10Size);
+        device()->seek(oldPos);
+    }
 
-    QDataStream s(device());
+    QDataStream s(bytes);
     s.setByteOrder(QDataStream::LittleEndian);
     s >> that->m_header;
     if (m_header.pixelFormat.fourCC == dx10Magic)
         s >> that->m_header10;
 
-    device()->seek(oldPos);
+    that->m_streamPos = headerSize + (m_header.pixelFormat.fourCC == dx10Magic ? header10Size : 0);
+    if (sequential && s.status() == QDataStream::Ok && !skipBytes(device(), m_streamPos))
+        return false;
 
     if (s.status() != QDataStream::Ok)
         return false;
@@ -1581,10 +3988,367 @@ bool QDDSHandler::ensureScanned() const
     if (that->m_format == FormatUnknown)
         return false;
 
+    if (!that->buildLayout())
+        return false;
+
+    that->storeCachedLayout();
     m_scanState = ScanSuccess;
     return true;
 }
 
+// Cached layouts are only trusted while the file keeps its identity, any
+// change to the path, inode, modification time or size invalidates them
+struct FileIdentity
+{
+    FileIdentity() : inode(0), modified(0), size(-1) {}
+
+    bool operator==(const FileIdentity &other) const
+    {
+        return inode == other.inode && modified == other.modified && size == other.size;
+    }
+
+    QString path;
+    quint64 inode;
+    qint64 modified;
+    qint64 size;
+};
+
+struct CachedLayout
+{
+    FileIdentity identity;
+    DDSHeader header;
+    DDSHeaderDX10 header10;
+    int format;
+    QVector<DDSSubresource> subresources;
+    QVector<int> subresourceIndex;
+    int mipmapCount;
+    int faceCount;
+    int arraySize;
+    quint32 depth;
+};
+
+struct LayoutCache
+{
+    LayoutCache() : entries(0), hits(0), misses(0) {}
+
+    QMutex mutex;
+    QCache<QString, CachedLayout> entries;
+    int hits;
+    int misses;
+};
+
+Q_GLOBAL_STATIC(LayoutCache, layoutCache)
+
+static bool identifyFile(QIODevice *device, FileIdentity &identity)
+{
+    QFile *file = qobject_cast<QFile *>(device);
+    if (!file || file->isSequential() || file->fileName().isEmpty())
+        return false;
+
+    identity.path = file->fileName();
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (file->handle() >= 0 && ::fstat(file->handle(), &st) == 0) {
+        identity.inode = quint64(st.st_ino);
+#ifdef Q_OS_LINUX
+        identity.modified = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#else
+        identity.modified = qint64(st.st_mtime) * 1000000000;
+#endif
+        identity.size = qint64(st.st_size);
+        return true;
+    }
+#endif
+    const QFileInfo info(identity.path);
+    identity.modified = info.lastModified().toMSecsSinceEpoch() * 1000000;
+    identity.size = info.size();
+    return info.exists();
+}
+
+bool QDDSHandler::loadCachedLayout()
+{
+    LayoutCache *cache = layoutCache();
+    FileIdentity identity;
+    QMutexLocker locker(&cache->mutex);
+    if (cache->entries.maxCost() <= 0 || !identifyFile(device(), identity))
+        return false;
+
+    const CachedLayout *layout = cache->entries.object(identity.path);
+    if (!layout || !(layout->identity == identity)) {
+        cache->misses++;
+        return false;
+    }
+
+    cache->hits++;
+    m_header = layout->header;
+    m_header10 = layout->header10;
+    m_format = layout->format;
+    m_subresources = layout->subresources;
+    m_subresourceIndex = layout->subresourceIndex;
+    m_mipmapCount = layout->mipmapCount;
+    m_faceCount = layout->faceCount;
+    m_arraySize = layout->arraySize;
+    m_depth = layout->depth;
+    m_streamPos = headerSize + (m_header.pixelFormat.fourCC == dx10Magic ? header10Size : 0);
+    return true;
+}
+
+void QDDSHandler::storeCachedLayout() const
+{
+    LayoutCache *cache = layoutCache();
+    FileIdentity identity;
+    QMutexLocker locker(&cache->mutex);
+    if (cache->entries.maxCost() <= 0 || !identifyFile(device(), identity))
+        return;
+
+    CachedLayout *layout = new CachedLayout;
+    layout->identity = identity;
+    layout->header = m_header;
+    layout->header10 = m_header10;
+    layout->format = m_format;
+    layout->subresources = m_subresources;
+    layout->subresourceIndex = m_subresourceIndex;
+    layout->mipmapCount = m_mipmapCount;
+    layout->faceCount = m_faceCount;
+    layout->arraySize = m_arraySize;
+    layout->depth = m_depth;
+    cache->entries.insert(identity.path, layout);
+}
+
+// Sets how many parsed headers and layouts are kept for the whole process,
+// 0 (the default) disables the cache
+void QDDSHandler::setLayoutCacheSize(int size)
+{
+    LayoutCache *cache = layoutCache();
+    QMutexLocker locker(&cache->mutex);
+    cache->entries.setMaxCost(qMax(0, size));
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+int QDDSHandler::layoutCacheSize()
+{
+    LayoutCache *cache = layoutCache();
+    QMutexLocker locker(&cache->mutex);
+    return cache->entries.maxCost();
+}
+
+// Scans that reused a cached layout since the last setLayoutCacheSize()
+int QDDSHandler::layoutCacheHits()
+{
+    LayoutCache *cache = layoutCache();
+    QMutexLocker locker(&cache->mutex);
+    return cache->hits;
+}
+
+// Scans of cacheable files that had to parse the header again, because the
+// file was new to the cache or had changed
+int QDDSHandler::layoutCacheMisses()
+{
+    LayoutCache *cache = layoutCache();
+    QMutexLocker locker(&cache->mutex);
+    return cache->misses;
+}
+
+// Computes the position of every mipmap level, cube map face, array slice
+// and volume slice in file order. D3D stores all levels of a face (and all
+// faces of an array slice) before the next one starts.
+bool QDDSHandler::buildLayout()
+{
+    m_subresources.clear();
+    m_subresourceIndex.clear();
+
+    const quint32 mipmapCount = qMax<quint32>(1, m_header.mipMapCount);
+    if (mipmapCount > maxMipmapCount) {
+        qWarning() << "Wrong dds.mipMapCount:" << m_header.mipMapCount;
+        return false;
+    }
+
+    const bool isDX10 = m_header.pixelFormat.fourCC == dx10Magic;
+    const bool isVolume = (m_header.caps2 & DDSHeader::Caps2Volume) != 0;
+    const quint32 arraySize = isDX10 ? qMax<quint32>(1, m_header10.arraySize) : 1;
+    const quint32 depth = isVolume ? qMax<quint32>(1, m_header.depth) : 1;
+    if (arraySize > maxArraySize) {
+        qWarning() << "Wrong dds10.arraySize:" << m_header10.arraySize;
+        return false;
+    }
+    if (depth > maxDepth) {
+        qWarning() << "Wrong dds.depth:" << m_header.depth;
+        return false;
+    }
+
+    // Sequential devices have no size to stop a bogus layout early, so the
+    // number of entries is bounded up front for every device
+    qint64 subresourceCount = 0;
+    for (quint32 level = 0; level < mipmapCount; level++)
+        subresourceCount += qMax<quint32>(1, depth >> level);
+    subresourceCount *= qint64(arraySize) * (isCubeMap(m_header) ? 6 : 1);
+    if (subresourceCount > maxSubresourceCount) {
+        qWarning() << "Too many subresources:" << subresourceCount;
+        return false;
+    }
+
+    m_mipmapCount = mipmapCount;
+    m_faceCount = isCubeMap(m_header) ? 6 : 1;
+    m_arraySize = arraySize;
+    m_depth = depth;
+
+    // Unsupported formats have no known size, reading them fails later
+    if (surfaceSize(m_header, m_format, m_header.width, m_header.height) <= 0)
+        return true;
+
+    quint32 blockWidth;
+    quint32 blockHeight;
+    blockSize(m_format, blockWidth, blockHeight);
+
+    // The size of a sequential device is not known up front
+    const qint64 deviceSize = device()->isSequential() ? -1 : device()->size();
+    qint64 offset = headerSize + (isDX10 ? header10Size : 0);
+    const qint64 indexCount = qint64(arraySize) * m_faceCount * m_mipmapCount;
+    m_subresourceIndex.fill(-1, int(indexCount));
+    for (quint32 slice = 0; slice < arraySize; slice++) {
+        for (int face = 0; face < m_faceCount; face++) {
+            if (m_faceCount == 6 && !(m_header.caps2 & faceFlags[face]))
+                continue; // Skip face.
+
+            for (quint32 level = 0; level < mipmapCount; level++) {
+                DDSSubresource subresource;
+                subresource.width = qMax<quint32>(1, m_header.width >> level);
+                subresource.height = qMax<quint32>(1, m_header.height >> level);
+                subresource.blockWidth = blockWidth;
+                subresource.blockHeight = blockHeight;
+                subresource.rowPitch = rowPitch(m_header, m_format, subresource.width);
+                subresource.format = Format(m_format);
+                subresource.size = surfaceSize(m_header, m_format, subresource.width, subresource.height);
+
+                const qint64 entry = (qint64(slice) * m_faceCount + face) * m_mipmapCount + level;
+                m_subresourceIndex[int(entry)] = m_subresources.size();
+
+                const quint32 levelDepth = qMax<quint32>(1, depth >> level);
+                for (quint32 z = 0; z < levelDepth; z++) {
+                    if (deviceSize >= 0 && offset + subresource.size > deviceSize) {
+                        qWarning() << "File is truncated: expected at least" << offset + subresource.size
+                                   << "bytes, actual size =" << deviceSize;
+                        return false;
+                    }
+                    subresource.offset = offset;
+                    m_subresources.append(subresource);
+                    offset += subresource.size;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Sequential devices can only move forward, bytes in front of the
+// subresource are read and thrown away
+bool QDDSHandler::loadSubresource(DataRange &range, const DDSSubresource &subresource)
+{
+    if (!device()->isSequential())
+        return range.load(device(), subresource.offset, subresource.size);
+
+    if (subresource.offset < m_streamPos) {
+        qWarning() << "Can't go back to offset" << subresource.offset << "on a sequential device";
+        return false;
+    }
+
+    if (!skipBytes(device(), subresource.offset - m_streamPos))
+        return false;
+    m_streamPos = subresource.offset;
+
+    if (!range.load(device(), subresource.offset, subresource.size))
+        return false;
+    m_streamPos += subresource.size;
+    return true;
+}
+
+// Memory allocated to decode a level. A face of -1 stands for the image
+// read() returns: cube maps are drawn on a canvas of 4x3 faces and the faces
+// are decoded straight into it.
+qint64 QDDSHandler::decodedSize(int level, int face) const
+{
+    if (face < 0 && isCubeMap(m_header)) {
+        for (face = 0; face < m_faceCount; face++) {
+            const int index = subresourceIndex(level, face, 0, 0);
+            if (index < 0)
+                continue;
+
+            // Faces always decode to 32-bit pixels
+            const DDSSubresource &subresource = m_subresources.at(index);
+            return qint64(subresource.width) * subresource.height * 12 * sizeof(QRgb);
+        }
+        return 0;
+    }
+
+    const int index = subresourceIndex(level, qMax(face, 0), 0, 0);
+    if (index < 0)
+        return 0;
+
+    const DDSSubresource &subresource = m_subresources.at(index);
+    return imageSize(m_format, subresource.width, subresource.height, decodeOptions(*this));
+}
+
+// Checks the decoded size against the budgets before anything is allocated.
+// Depending on the policy, levels that don't fit either fail or are replaced
+// by the largest smaller level that does. Images larger than a QImage can
+// hold never fit, even without a budget.
+int QDDSHandler::levelWithinBudget(int level, int face, MemoryReservation &reservation) const
+{
+    if (level < 0 || level >= m_mipmapCount)
+        return -1;
+
+    for (int i = level; i < m_mipmapCount; i++) {
+        const qint64 size = decodedSize(i, face);
+        if (size <= std::numeric_limits<int>::max() && (m_memoryBudget <= 0 || size <= m_memoryBudget)
+                && reservation.reserve(size)) {
+            return i;
+        }
+
+        if (m_memoryBudgetPolicy != FallBackToSmallerMipmap)
+            break;
+    }
+
+    qWarning() << "Decoding level" << level << "exceeds the memory budget";
+    return -1;
+}
+
+// Requests the levels that follow in iteration order from the page cache
+void QDDSHandler::prefetch(int level) const
+{
+    QFile *file = qobject_cast<QFile *>(device());
+    if (!file || file->isSequential())
+        return;
+
+    const int last = qMin(level + m_prefetchDepth, m_mipmapCount);
+    for (int i = level; i < last; i++) {
+        for (int face = 0; face < m_faceCount; face++) {
+            const int index = subresourceIndex(i, face, 0, 0);
+            if (index < 0)
+                continue;
+
+            const DDSSubresource &subresource = m_subresources.at(index);
+            adviseWillNeed(file, subresource.offset, subresource.size);
+        }
+    }
+}
+
+int QDDSHandler::subresourceIndex(int level, int face, int arraySlice, int depthSlice) const
+{
+    if (level < 0 || level >= m_mipmapCount || face < 0 || face >= m_faceCount
+            || arraySlice < 0 || arraySlice >= m_arraySize || depthSlice < 0) {
+        return -1;
+    }
+
+    if (quint32(depthSlice) >= qMax<quint32>(1, m_depth >> level))
+        return -1;
+
+    const qint64 entry = (qint64(arraySlice) * m_faceCount + face) * m_mipmapCount + level;
+    const int first = m_subresourceIndex.value(int(entry), -1);
+    return first < 0 ? -1 : first + depthSlice;
+}
+
 bool QDDSHandler::verifyHeader(const DDSHeader &dds) const
 {
     quint32 flags = dds.flags;
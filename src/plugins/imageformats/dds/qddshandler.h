@@ -41,6 +41,8 @@
 #ifndef QDDSHANDLER_H
 #define QDDSHANDLER_H
 
+#include <QtCore/qfuture.h>
+#include <QtCore/qvector.h>
 #include <QtGui/qimageiohandler.h>
 #include "ddsheader.h"
 
@@ -48,9 +50,48 @@
 
 QT_BEGIN_NAMESPACE
 
+class DataRange;
+class MemoryReservation;
+
+struct DDSSubresource
+{
+    DDSSubresource() :
+        offset(-1), size(0), width(0), height(0),
+        blockWidth(0), blockHeight(0), rowPitch(0), format(FormatUnknown)
+    {}
+
+    bool isValid() const { return offset >= 0; }
+
+    qint64 offset;
+    qint64 size;
+    quint32 width;
+    quint32 height;
+    quint32 blockWidth;
+    quint32 blockHeight;
+    qint64 rowPitch;
+    Format format;
+};
+
+class DDSStripSink
+{
+public:
+    virtual ~DDSStripSink() {}
+    virtual bool writeStrip(const QImage &strip, int y) = 0;
+};
+
 class QDDSHandler : public QImageIOHandler
 {
 public:
+    enum MemoryBudgetPolicy {
+        FailOverBudget,
+        FallBackToSmallerMipmap
+    };
+
+    enum YuvMatrix {
+        YuvMatrixBt601,
+        YuvMatrixBt709
+    };
+
     QDDSHandler();
 
     QByteArray name() const override;
@@ -66,11 +107,56 @@ public:
     int imageCount() const override;
     bool jumpToImage(int imageNumber) override;
 
+    int faceCount() const;
+    int arraySize() const;
+    int depth(int level = 0) const;
+    DDSSubresource subresource(int level, int face = 0, int arraySlice = 0, int depthSlice = 0) const;
+    QFuture<QImage> readAsync(int level, int face = 0, int arraySlice = 0, int depthSlice = 0);
+    bool readStrips(DDSStripSink *sink, int stripHeight, int level = 0, int face = 0);
+    QImage readRows(int y, int height, int level = 0, int face = 0);
+    QVector<QImage> readMipmaps();
+
+    void setMemoryBudget(qint64 bytes, MemoryBudgetPolicy policy = FailOverBudget);
+    qint64 memoryBudget() const;
+    MemoryBudgetPolicy memoryBudgetPolicy() const;
+
+    void setPrefetchDepth(int depth);
+    int prefetchDepth() const;
+
+    void setYuvMatrix(YuvMatrix matrix);
+    YuvMatrix yuvMatrix() const;
+
+    void setPaletteExpansionEnabled(bool enabled);
+    bool isPaletteExpansionEnabled() const;
+
+    void setImageMappingEnabled(bool enabled);
+    bool isImageMappingEnabled() const;
+
     static bool canRead(QIODevice *device);
 
+    static void setLayoutCacheSize(int size);
+    static int layoutCacheSize();
+    static int layoutCacheHits();
+    static int layoutCacheMisses();
+
+    static void setProcessMemoryBudget(qint64 bytes);
+    static qint64 processMemoryBudget();
+
 private:
     bool ensureScanned() const;
+    QImage::Format imageFormat() const;
     bool verifyHeader(const DDSHeader &dds) const;
+    bool buildLayout();
+    bool loadCachedLayout();
+    void storeCachedLayout() const;
+    int subresourceIndex(int level, int face, int arraySlice, int depthSlice) const;
+    qint64 decodedSize(int level, int face) const;
+    int levelWithinBudget(int level, int face, MemoryReservation &reservation) const;
+    bool loadSubresource(DataRange &range, const DDSSubresource &subresource);
+    QVector<QImage> readEachMipmap();
+    bool decodeStrips(DDSStripSink *sink, const DDSSubresource &texture,
+                      quint32 first, quint32 last, int stripHeight, qint64 sinkSize = 0);
+    void prefetch(int level) const;
 
 private:
     enum ScanState {
@@ -83,6 +169,19 @@ private:
     int m_format;
     DDSHeaderDX10 m_header10;
     int m_currentImage;
+    QVector<DDSSubresource> m_subresources;
+    QVector<int> m_subresourceIndex;
+    int m_mipmapCount;
+    int m_faceCount;
+    int m_arraySize;
+    quint32 m_depth;
+    int m_prefetchDepth;
+    qint64 m_memoryBudget;
+    MemoryBudgetPolicy m_memoryBudgetPolicy;
+    YuvMatrix m_yuvMatrix;
+    bool m_expandPalettes;
+    mutable qint64 m_streamPos;
+    bool m_mapImages;
     mutable ScanState m_scanState;
 };
 
@@ -1,10 +1,21 @@
 TARGET = tst_dds
 
-QT = core gui testlib
+QT = core gui concurrent testlib
 CONFIG -= app_bundle
 CONFIG += testcase
 
 DESTDIR = ../../../
 
-SOURCES += tst_qdds.cpp
+DDS_DIR = ../../../src/plugins/imageformats/dds
+INCLUDEPATH += $$DDS_DIR
+
+HEADERS += \
+    $$DDS_DIR/ddsheader.h \
+    $$DDS_DIR/qddshandler.h
+
+SOURCES += \
+    tst_qdds.cpp \
+    $$DDS_DIR/ddsheader.cpp \
+    $$DDS_DIR/qddshandler.cpp
+
 RESOURCES += tst_qdds.qrc
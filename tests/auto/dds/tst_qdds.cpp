@@ -30,6 +30,197 @@
 #include <QtTest/QtTest>
 #include <QtGui/QtGui>
 
+#include "qddshandler.h"
+
+// Delivers chunkSize bytes per waitForReadyRead() call when chunkSize is
+// set, like a socket would
+class SequentialDevice : public QIODevice
+{
+public:
+    explicit SequentialDevice(const QByteArray &data, int chunkSize = 0)
+        : m_data(data), m_pos(0), m_available(chunkSize ? 0 : data.size()), m_chunkSize(chunkSize) {}
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override { return m_available - m_pos + QIODevice::bytesAvailable(); }
+    bool waitForReadyRead(int) override
+    {
+        if (m_available == m_data.size())
+            return false;
+        m_available = qMin<qint64>(m_available + m_chunkSize, m_data.size());
+        return true;
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        if (m_pos == m_data.size())
+            return -1;
+        maxSize = qMin(maxSize, m_available - m_pos);
+        memcpy(data, m_data.constData() + m_pos, size_t(maxSize));
+        m_pos += maxSize;
+        return maxSize;
+    }
+    qint64 writeData(const char *, qint64) override { return -1; }
+
+private:
+    QByteArray m_data;
+    qint64 m_pos;
+    qint64 m_available;
+    int m_chunkSize;
+};
+
+class RandomAccessDevice : public QIODevice
+{
+public:
+    explicit RandomAccessDevice(const QByteArray &data) : m_data(data), m_pos(0) {}
+
+    qint64 size() const override { return m_data.size(); }
+    bool seek(qint64 pos) override
+    {
+        if (pos < 0 || pos > m_data.size() || !QIODevice::seek(pos))
+            return false;
+        m_pos = pos;
+        return true;
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        maxSize = qMin(maxSize, qint64(m_data.size()) - m_pos);
+        if (maxSize <= 0)
+            return 0;
+        memcpy(data, m_data.constData() + m_pos, size_t(maxSize));
+        m_pos += maxSize;
+        return maxSize;
+    }
+    qint64 writeData(const char *, qint64) override { return -1; }
+
+private:
+    QByteArray m_data;
+    qint64 m_pos;
+};
+
+class StripCollector : public DDSStripSink
+{
+public:
+    explicit StripCollector(const QSize &size) : maxHeight(0), m_size(size) {}
+
+    bool writeStrip(const QImage &strip, int y) override
+    {
+        if (image.isNull())
+            image = QImage(m_size, strip.format());
+        maxHeight = qMax(maxHeight, strip.height());
+        for (int row = 0; row < strip.height(); ++row)
+            memcpy(image.scanLine(y + row), strip.constScanLine(row), size_t(image.bytesPerLine()));
+        return true;
+    }
+
+    QImage image;
+    int maxHeight;
+
+private:
+    QSize m_size;
+};
+
+// A file with A8R8G8B8 subresources of the given size and layout, followed
+// by the zeroed pixels of subresourceCount 1x1 subresources
+static QByteArray layoutData(quint32 arraySize, quint32 depth, int subresourceCount,
+                             const QSize &size = QSize(1, 1))
+{
+    QFile file(QStringLiteral(":/dds/A8R8G8B8.dds"));
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    QDataStream in(&file);
+    in.setByteOrder(QDataStream::LittleEndian);
+    DDSHeader header;
+    in >> header;
+    header.width = quint32(size.width());
+    header.height = quint32(size.height());
+    header.mipMapCount = 1;
+    header.depth = depth;
+    if (depth > 1)
+        header.caps2 |= DDSHeader::Caps2Volume;
+
+    DDSHeaderDX10 header10;
+    memset(&header10, 0, sizeof(header10));
+    header10.arraySize = arraySize;
+    if (arraySize > 1)
+        header.pixelFormat.fourCC = 0x30315844; // "DX10"
+
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out << header;
+    if (arraySize > 1)
+        out << header10;
+    return data + QByteArray(subresourceCount * 4, 0);
+}
+
+// A file with the format of a fixture and width x height pixels, which
+// are pseudo-random unless given, or the fixture itself when size is invalid
+static QByteArray pixelData(const QString &fileName, const QSize &size,
+                            const QByteArray &pixels = QByteArray())
+{
+    QFile file(QStringLiteral(":/dds/") + fileName + QStringLiteral(".dds"));
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    if (!size.isValid())
+        return file.readAll();
+
+    QDataStream in(&file);
+    in.setByteOrder(QDataStream::LittleEndian);
+    DDSHeader header;
+    in >> header;
+    header.width = quint32(size.width());
+    header.height = quint32(size.height());
+    header.mipMapCount = 1;
+
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out << header;
+    if (!pixels.isEmpty())
+        return data + pixels;
+
+    // Enough for the palette and the widest pixel or block
+    const int count = 1024 + 16 * (size.width() + 3) * (size.height() + 3);
+    quint32 seed = 1;
+    for (int i = 0; i < count; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        data.append(char(seed >> 24));
+    }
+    return data;
+}
+
+// Copies a fixture into file and rewinds it, for tests that need a real file
+// rather than a resource
+static bool copyFixture(const QString &fileName, QTemporaryFile *file)
+{
+    QFile resource(QStringLiteral(":/dds/") + fileName + QStringLiteral(".dds"));
+    if (!resource.open(QIODevice::ReadOnly) || !file->open())
+        return false;
+
+    const QByteArray data = resource.readAll();
+    return file->write(data) == data.size() && file->flush() && file->seek(0);
+}
+
+// A checksum of the pixel colors that doesn't depend on the image format or
+// the byte order
+static QByteArray pixelChecksum(const QImage &image)
+{
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    for (int y = 0; y < image.height(); ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            const QRgb pixel = image.pixel(x, y);
+            const char bytes[4] = { char(qRed(pixel)), char(qGreen(pixel)), char(qBlue(pixel)),
+                                    char(qAlpha(pixel)) };
+            hash.addData(bytes, 4);
+        }
+    }
+    return hash.result().toHex();
+}
+
 class tst_qdds: public QObject
 {
     Q_OBJECT
@@ -38,10 +229,36 @@ private slots:
     void initTestCase();
     void readImage_data();
     void readImage();
+    void testPixels_data();
+    void testPixels();
     void testMipmaps_data();
     void testMipmaps();
+    void testSubresources_data();
+    void testSubresources();
+    void testReadAsync_data();
+    void testReadAsync();
+    void testReadMipmaps();
+    void testSequentialDevice();
+    void testChunkedDevice_data();
+    void testChunkedDevice();
+    void testLayoutLimits_data();
+    void testLayoutLimits();
+    void testLayoutCache();
+    void testMemoryBudget();
+    void testStrips_data();
+    void testStrips();
+    void testReadInPlace();
+    void testYuvMatrix();
+    void testPaletteExpansion_data();
+    void testPaletteExpansion();
     void testWriteImage_data();
     void testWriteImage();
+    void testDevices_data();
+    void testDevices();
+    void testImageMapping_data();
+    void testImageMapping();
+    void testPrefetch_data();
+    void testPrefetch();
 };
 
 void tst_qdds::initTestCase()
@@ -125,6 +342,291 @@ void tst_qdds::readImage()
     QCOMPARE(image.size(), size);
 }
 
+void tst_qdds::testPixels_data()
+{
+    QTest::addColumn<QString>("fileName");
+    QTest::addColumn<QSize>("size");
+    QTest::addColumn<QByteArray>("checksum");
+
+    // Computed with the original QDataStream decoders, so both the plain and
+    // the vector paths are checked against them. UYVY and YUY2 are the
+    // exception: they now round and saturate instead of truncating and
+    // wrapping. So are the random float rows, whose out of range values
+    // used to overflow the conversion to 8 bits and are now clamped. The
+    // odd sizes leave partial blocks and vectors at the end of the rows.
+    QTest::newRow("A1R5G5B5") << QString("A1R5G5B5") << QSize()
+                              << QByteArray("f2bd774f08b570ae3b112cf6af5f81b6");
+    QTest::newRow("A2B10G10R10") << QString("A2B10G10R10") << QSize()
+                                 << QByteArray("1db508cacf3e027df2c2e2f50616a48a");
+    QTest::newRow("A2R10G10B10") << QString("A2R10G10B10") << QSize()
+                                 << QByteArray("1db508cacf3e027df2c2e2f50616a48a");
+    QTest::newRow("A2W10V10U10") << QString("A2W10V10U10") << QSize()
+                                 << QByteArray("1db508cacf3e027df2c2e2f50616a48a");
+    QTest::newRow("A4L4") << QString("A4L4") << QSize()
+                          << QByteArray("54af55da725093e6febc681269f142ad");
+    QTest::newRow("A4R4G4B4") << QString("A4R4G4B4") << QSize()
+                              << QByteArray("229b3ce04a9daae51c7017d77eb28381");
+    QTest::newRow("A8") << QString("A8") << QSize()
+                        << QByteArray("2637997487bb482d9c76c37f5f8cc92a");
+    QTest::newRow("A8B8G8R8") << QString("A8B8G8R8") << QSize()
+                              << QByteArray("cc999b678fdf4897fd5744ebf3da585d");
+    QTest::newRow("A8L8") << QString("A8L8") << QSize()
+                          << QByteArray("a03b773f932e9bf3bffb40189a71857d");
+    QTest::newRow("A8R3G3B2") << QString("A8R3G3B2") << QSize()
+                              << QByteArray("bd92e50c6841c5d3b63521a34dc538b4");
+    QTest::newRow("A8R8G8B8") << QString("A8R8G8B8") << QSize()
+                              << QByteArray("cc999b678fdf4897fd5744ebf3da585d");
+    QTest::newRow("A16B16G16R16") << QString("A16B16G16R16") << QSize()
+                                  << QByteArray("cc999b678fdf4897fd5744ebf3da585d");
+    QTest::newRow("A16B16G16R16F") << QString("A16B16G16R16F") << QSize()
+                                   << QByteArray("4d3d120ab2f3f4ea9911bdcf82e4ff1b");
+    QTest::newRow("A32B32G32R32F") << QString("A32B32G32R32F") << QSize()
+                                   << QByteArray("cc999b678fdf4897fd5744ebf3da585d");
+    QTest::newRow("CxV8U8") << QString("CxV8U8") << QSize()
+                            << QByteArray("75f9371aa059e6d70048594f221a6885");
+    QTest::newRow("DXT1") << QString("DXT1") << QSize()
+                          << QByteArray("1635a1c2064f368b5125a25c29e6a1d4");
+    QTest::newRow("DXT2") << QString("DXT2") << QSize()
+                          << QByteArray("a9c3c07532bdd46aca697a5afa5eb06a");
+    QTest::newRow("DXT3") << QString("DXT3") << QSize()
+                          << QByteArray("3ce219167207bb6c3bc535904cf8fb03");
+    QTest::newRow("DXT4") << QString("DXT4") << QSize()
+                          << QByteArray("9617dc44912b15bba25f1dbe0fa11975");
+    QTest::newRow("DXT5") << QString("DXT5") << QSize()
+                          << QByteArray("5e72e9cf59a2487789a84a3df510f7fb");
+    QTest::newRow("G8R8_G8B8") << QString("G8R8_G8B8") << QSize()
+                               << QByteArray("318acaf731c130cf4b4afeb4118cfb99");
+    QTest::newRow("G16R16") << QString("G16R16") << QSize()
+                            << QByteArray("d00760ccc2e1a3dec2b026c63fdae5f1");
+    QTest::newRow("G16R16F") << QString("G16R16F") << QSize()
+                             << QByteArray("d2b9d7ca8e4b0a42f0be68a975131120");
+    QTest::newRow("G32R32F") << QString("G32R32F") << QSize()
+                             << QByteArray("d00760ccc2e1a3dec2b026c63fdae5f1");
+    QTest::newRow("L6V5U5") << QString("L6V5U5") << QSize()
+                            << QByteArray("9d06e9ae9c2c4be40d786815bca6e03a");
+    QTest::newRow("L8") << QString("L8") << QSize()
+                        << QByteArray("55308b8652b10a4c05604a72b13d28b4");
+    QTest::newRow("L16") << QString("L16") << QSize()
+                         << QByteArray("48b5ae8b7a03dd365bbd978993e137b5");
+    QTest::newRow("P8") << QString("P8") << QSize()
+                        << QByteArray("066e168d994156cfd45d6111dd15d76b");
+    QTest::newRow("Q8W8V8U8") << QString("Q8W8V8U8") << QSize()
+                              << QByteArray("6be5345c680e8e126f1f6110ea16188e");
+    QTest::newRow("Q16W16V16U16") << QString("Q16W16V16U16") << QSize()
+                                  << QByteArray("cc999b678fdf4897fd5744ebf3da585d");
+    QTest::newRow("R3G3B2") << QString("R3G3B2") << QSize()
+                            << QByteArray("f85690e2c5585d75e605db6df22c8d17");
+    QTest::newRow("R5G6B5") << QString("R5G6B5") << QSize()
+                            << QByteArray("73f6b143c569e9deac266a28a603fd10");
+    QTest::newRow("R8G8_B8G8") << QString("R8G8_B8G8") << QSize()
+                               << QByteArray("318acaf731c130cf4b4afeb4118cfb99");
+    QTest::newRow("R8G8B8") << QString("R8G8B8") << QSize()
+                            << QByteArray("6fd921814db031ef45e5823583b9e5ef");
+    QTest::newRow("R16F") << QString("R16F") << QSize()
+                          << QByteArray("61cc32df856f66915429856979aa6115");
+    QTest::newRow("R32F") << QString("R32F") << QSize()
+                          << QByteArray("80334b2bda5aeedfd394aed85cabb9a6");
+    QTest::newRow("UYVY") << QString("UYVY") << QSize()
+                          << QByteArray("0419b0a81db180c008e15d1dcd4ce320");
+    QTest::newRow("V8U8") << QString("V8U8") << QSize()
+                          << QByteArray("490ace97ef2f6c3a375b01010bd14afb");
+    QTest::newRow("V16U16") << QString("V16U16") << QSize()
+                            << QByteArray("eb070a513843b75913462393171c550a");
+    QTest::newRow("X1R5G5B5") << QString("X1R5G5B5") << QSize()
+                              << QByteArray("5a93ee8f8f6917d9c8db02a4abb03caa");
+    QTest::newRow("X4R4G4B4") << QString("X4R4G4B4") << QSize()
+                              << QByteArray("4b48cf9542f3ece47c874488967a35b3");
+    QTest::newRow("X8B8G8R8") << QString("X8B8G8R8") << QSize()
+                              << QByteArray("6fd921814db031ef45e5823583b9e5ef");
+    QTest::newRow("X8L8V8U8") << QString("X8L8V8U8") << QSize()
+                              << QByteArray("18d0dbccf920e7c5a334b0a47c65d43f");
+    QTest::newRow("X8R8G8B8") << QString("X8R8G8B8") << QSize()
+                              << QByteArray("6fd921814db031ef45e5823583b9e5ef");
+    QTest::newRow("YUY2") << QString("YUY2") << QSize()
+                          << QByteArray("0419b0a81db180c008e15d1dcd4ce320");
+    QTest::newRow("RXGB") << QString("RXGB") << QSize()
+                          << QByteArray("26c4be940f335aea82669c45bed81ece");
+    QTest::newRow("ATI2") << QString("ATI2") << QSize()
+                          << QByteArray("5fe4125f1e445250f0012cdfd81225ec");
+    QTest::newRow("A8P8") << QString("A8P8") << QSize()
+                          << QByteArray("ca6bf23b0deec16fb4de17a305afaa1a");
+    QTest::newRow("P4") << QString("P4") << QSize()
+                        << QByteArray("665edc7433be52990d73444e7bfb604e");
+    QTest::newRow("A4P4") << QString("A4P4") << QSize()
+                          << QByteArray("7122443eabaf46dfcc899d151c77386e");
+    QTest::newRow("A8R8G8B8.2") << QString("A8R8G8B8.2") << QSize()
+                                << QByteArray("3567f448a6db1faa1dc243dd9f4e8d8b");
+    QTest::newRow("cubemap") << QString("cubemap") << QSize()
+                             << QByteArray("a135724b95902397931c1e2e998f9fdc");
+    QTest::newRow("DXT1 1x1") << QString("DXT1") << QSize(1, 1)
+                              << QByteArray("e85a8e2cb7fdf836a8c8d223ba1b64f5");
+    QTest::newRow("DXT1 67x9") << QString("DXT1") << QSize(67, 9)
+                               << QByteArray("e6fdd302164efe5929d5a9d4b54498c5");
+    QTest::newRow("DXT2 1x1") << QString("DXT2") << QSize(1, 1)
+                              << QByteArray("2a5ffbae538b9d532f227e896c1712a7");
+    QTest::newRow("DXT2 67x9") << QString("DXT2") << QSize(67, 9)
+                               << QByteArray("7710ebaae208d7650ee2861c3ccf85ad");
+    QTest::newRow("DXT3 1x1") << QString("DXT3") << QSize(1, 1)
+                              << QByteArray("49c262632fc30df10fc9091e5c5a3a9f");
+    QTest::newRow("DXT3 67x9") << QString("DXT3") << QSize(67, 9)
+                               << QByteArray("9bc5b9d2aab14c16d800020e0d9ad878");
+    QTest::newRow("DXT4 1x1") << QString("DXT4") << QSize(1, 1)
+                              << QByteArray("a729abc96a9122426fe3b7adf1d400be");
+    QTest::newRow("DXT4 67x9") << QString("DXT4") << QSize(67, 9)
+                               << QByteArray("3f5f30debb96408064e31372c18922a4");
+    QTest::newRow("DXT5 1x1") << QString("DXT5") << QSize(1, 1)
+                              << QByteArray("b4d33ced9eff7897fc2451055f38232e");
+    QTest::newRow("DXT5 67x9") << QString("DXT5") << QSize(67, 9)
+                               << QByteArray("a7c093c7ba358b505510d45f7512047b");
+    QTest::newRow("RXGB 1x1") << QString("RXGB") << QSize(1, 1)
+                              << QByteArray("461416b10b1895c28dac70021e4d6f4a");
+    QTest::newRow("RXGB 67x9") << QString("RXGB") << QSize(67, 9)
+                               << QByteArray("c049f9c1a1560606c3af09680d2dbc13");
+    QTest::newRow("ATI2 1x1") << QString("ATI2") << QSize(1, 1)
+                              << QByteArray("3048363a1c7e930d0c04772f353e09ff");
+    QTest::newRow("ATI2 67x9") << QString("ATI2") << QSize(67, 9)
+                               << QByteArray("fe0a16014f11153ef0c624da95ab4d1c");
+    QTest::newRow("R8G8B8 1x1") << QString("R8G8B8") << QSize(1, 1)
+                                << QByteArray("94a462102b88eb10ff3aff4902142030");
+    QTest::newRow("R8G8B8 67x9") << QString("R8G8B8") << QSize(67, 9)
+                                 << QByteArray("c6a790355b5040b866d68e0583e9c44c");
+    QTest::newRow("A8R8G8B8 1x1") << QString("A8R8G8B8") << QSize(1, 1)
+                                  << QByteArray("0045a3c33fa0bc6c5d647fdad7e2fa8c");
+    QTest::newRow("A8R8G8B8 67x9") << QString("A8R8G8B8") << QSize(67, 9)
+                                   << QByteArray("6ca002d3faa1aaa3b67d20422d174935");
+    QTest::newRow("X8R8G8B8 1x1") << QString("X8R8G8B8") << QSize(1, 1)
+                                  << QByteArray("94a462102b88eb10ff3aff4902142030");
+    QTest::newRow("X8R8G8B8 67x9") << QString("X8R8G8B8") << QSize(67, 9)
+                                   << QByteArray("1d234a25acddedcee8b0e14705b97535");
+    QTest::newRow("R5G6B5 1x1") << QString("R5G6B5") << QSize(1, 1)
+                                << QByteArray("d245eade29d9d70f1d58eb286a4b34ba");
+    QTest::newRow("R5G6B5 67x9") << QString("R5G6B5") << QSize(67, 9)
+                                 << QByteArray("9bb3268e24b37759538e620f5dbb821f");
+    QTest::newRow("A8B8G8R8 1x1") << QString("A8B8G8R8") << QSize(1, 1)
+                                  << QByteArray("70b9a4179859480a40c16a5d986b64f1");
+    QTest::newRow("A8B8G8R8 67x9") << QString("A8B8G8R8") << QSize(67, 9)
+                                   << QByteArray("9c9ea393c1a3c9959ccb22e7b06c1d57");
+    QTest::newRow("L8 1x1") << QString("L8") << QSize(1, 1)
+                            << QByteArray("605d91f4a899dac7b7ea709ce5502aaa");
+    QTest::newRow("L8 67x9") << QString("L8") << QSize(67, 9)
+                             << QByteArray("97f1cf702acb53ca0202f362b54be444");
+    QTest::newRow("A8L8 1x1") << QString("A8L8") << QSize(1, 1)
+                              << QByteArray("8bff7f0fbbb0aea6d1a20732f89c8691");
+    QTest::newRow("A8L8 67x9") << QString("A8L8") << QSize(67, 9)
+                               << QByteArray("9ddbc6565d646d090b699126359784cd");
+    QTest::newRow("A16B16G16R16 1x1") << QString("A16B16G16R16") << QSize(1, 1)
+                                      << QByteArray("1bc345306def2d4d243193d5199f0f5a");
+    QTest::newRow("A16B16G16R16 67x9") << QString("A16B16G16R16") << QSize(67, 9)
+                                       << QByteArray("a2b17f20e36f35fc459b164a3e652bfa");
+    QTest::newRow("A2R10G10B10 1x1") << QString("A2R10G10B10") << QSize(1, 1)
+                                     << QByteArray("f613379d0adc16944cedda2246086840");
+    QTest::newRow("A2R10G10B10 67x9") << QString("A2R10G10B10") << QSize(67, 9)
+                                      << QByteArray("3be9011bf4dc347720b313096c7e52b0");
+    QTest::newRow("A2B10G10R10 1x1") << QString("A2B10G10R10") << QSize(1, 1)
+                                     << QByteArray("1cf41d3c90ed3ac2fc395180defa32b0");
+    QTest::newRow("A2B10G10R10 67x9") << QString("A2B10G10R10") << QSize(67, 9)
+                                      << QByteArray("481f37c1effa1cf724a27a5a419498bc");
+    QTest::newRow("V8U8 1x1") << QString("V8U8") << QSize(1, 1)
+                              << QByteArray("025a6052a65b8cf59cb3272b45d72890");
+    QTest::newRow("V8U8 67x9") << QString("V8U8") << QSize(67, 9)
+                               << QByteArray("708362d2742a00da6464e9c7b4282709");
+    QTest::newRow("L6V5U5 1x1") << QString("L6V5U5") << QSize(1, 1)
+                                << QByteArray("ff63ecd6b3c56c9f64963a1bb2412237");
+    QTest::newRow("L6V5U5 67x9") << QString("L6V5U5") << QSize(67, 9)
+                                 << QByteArray("e4d08fe8bc993cb4606d23862504dde0");
+    QTest::newRow("X8L8V8U8 1x1") << QString("X8L8V8U8") << QSize(1, 1)
+                                  << QByteArray("eb882e88011436713af7fc2f42538fee");
+    QTest::newRow("X8L8V8U8 67x9") << QString("X8L8V8U8") << QSize(67, 9)
+                                   << QByteArray("55dd6fc1239a512f16f9cd8c564fa9ec");
+    QTest::newRow("Q8W8V8U8 1x1") << QString("Q8W8V8U8") << QSize(1, 1)
+                                  << QByteArray("6d2d472c7e2b16e0b3c74d7689f0d2c3");
+    QTest::newRow("Q8W8V8U8 67x9") << QString("Q8W8V8U8") << QSize(67, 9)
+                                   << QByteArray("31fea06a9b64602a1ca68ff5f16a2ee3");
+    QTest::newRow("V16U16 1x1") << QString("V16U16") << QSize(1, 1)
+                                << QByteArray("7719b6fcfe5754697a839f026f5dd385");
+    QTest::newRow("V16U16 67x9") << QString("V16U16") << QSize(67, 9)
+                                 << QByteArray("72ec45b184e2c2eea46370d6fe6a0999");
+    QTest::newRow("A2W10V10U10 1x1") << QString("A2W10V10U10") << QSize(1, 1)
+                                     << QByteArray("ed5aeec78142ead7492ba4b0118f570e");
+    QTest::newRow("A2W10V10U10 67x9") << QString("A2W10V10U10") << QSize(67, 9)
+                                      << QByteArray("ab2e85898d244f6f064bb53a77e265a2");
+    QTest::newRow("Q16W16V16U16 1x1") << QString("Q16W16V16U16") << QSize(1, 1)
+                                      << QByteArray("f9b8109317e5bf4838a74c0a0e948e1c");
+    QTest::newRow("Q16W16V16U16 67x9") << QString("Q16W16V16U16") << QSize(67, 9)
+                                       << QByteArray("43c702b9f54f2e317578da94c29efdf1");
+    QTest::newRow("CxV8U8 1x1") << QString("CxV8U8") << QSize(1, 1)
+                                << QByteArray("3fb357f3c168370bc11ca77cb730b19e");
+    QTest::newRow("CxV8U8 67x9") << QString("CxV8U8") << QSize(67, 9)
+                                 << QByteArray("6b3af21f363615a37cdd6038c4613d6e");
+    QTest::newRow("R16F 1x1") << QString("R16F") << QSize(1, 1)
+                              << QByteArray("4bcd779a6d1cb005a4731d447682d40b");
+    QTest::newRow("R16F 67x9") << QString("R16F") << QSize(67, 9)
+                               << QByteArray("c1ca98e3ae0b6533edb7d8af72b01c3c");
+    QTest::newRow("G16R16F 1x1") << QString("G16R16F") << QSize(1, 1)
+                                 << QByteArray("4bcd779a6d1cb005a4731d447682d40b");
+    QTest::newRow("G16R16F 67x9") << QString("G16R16F") << QSize(67, 9)
+                                  << QByteArray("7d9c60af070a8afb32f755af433ed26d");
+    QTest::newRow("A16B16G16R16F 1x1") << QString("A16B16G16R16F") << QSize(1, 1)
+                                       << QByteArray("a3973315972cdf7e0ef4ed344b948fd8");
+    QTest::newRow("A16B16G16R16F 67x9") << QString("A16B16G16R16F") << QSize(67, 9)
+                                        << QByteArray("4feed54d66d7f489def4db15e171e1cc");
+    QTest::newRow("R32F 1x1") << QString("R32F") << QSize(1, 1)
+                              << QByteArray("bbd822615535efc59c0719b820e06fd9");
+    QTest::newRow("R32F 67x9") << QString("R32F") << QSize(67, 9)
+                               << QByteArray("6098e485526de8c826f06ce1e9fe4603");
+    QTest::newRow("G32R32F 1x1") << QString("G32R32F") << QSize(1, 1)
+                                 << QByteArray("bbd822615535efc59c0719b820e06fd9");
+    QTest::newRow("G32R32F 67x9") << QString("G32R32F") << QSize(67, 9)
+                                  << QByteArray("d82d2f1b08d1ddc55ddbfeb3b971b527");
+    QTest::newRow("A32B32G32R32F 1x1") << QString("A32B32G32R32F") << QSize(1, 1)
+                                       << QByteArray("83f4ebd2a2fc94dc5314a798543a9428");
+    QTest::newRow("A32B32G32R32F 67x9") << QString("A32B32G32R32F") << QSize(67, 9)
+                                        << QByteArray("f350b7245cc9acca65628e249d9e7bb7");
+    QTest::newRow("P8 1x1") << QString("P8") << QSize(1, 1)
+                            << QByteArray("ffc9ac373b9997f958a7a094e1dce08b");
+    QTest::newRow("P8 67x9") << QString("P8") << QSize(67, 9)
+                             << QByteArray("c944fcec15232e48f3c0d38e6d4e1501");
+    QTest::newRow("P4 1x1") << QString("P4") << QSize(1, 1)
+                            << QByteArray("ffb033f51dfaf64fb9d9318127346362");
+    QTest::newRow("P4 67x9") << QString("P4") << QSize(67, 9)
+                             << QByteArray("241699a2ba89aaae780f62cce4a1d0aa");
+    QTest::newRow("UYVY 1x1") << QString("UYVY") << QSize(1, 1)
+                              << QByteArray("c8b6ace236e3b76cfff520185c796c9d");
+    QTest::newRow("UYVY 67x9") << QString("UYVY") << QSize(67, 9)
+                               << QByteArray("f70a5f9d9c94ddba1359c4c78b42db44");
+    QTest::newRow("YUY2 1x1") << QString("YUY2") << QSize(1, 1)
+                              << QByteArray("a325e1bcb18f030ba206e1a5b992db34");
+    QTest::newRow("YUY2 67x9") << QString("YUY2") << QSize(67, 9)
+                               << QByteArray("065cc05c8da1b541ad9ce6b034cda2fa");
+    QTest::newRow("R8G8_B8G8 1x1") << QString("R8G8_B8G8") << QSize(1, 1)
+                                   << QByteArray("47fe01c18a282d9dd065d4348d8255e7");
+    QTest::newRow("R8G8_B8G8 67x9") << QString("R8G8_B8G8") << QSize(67, 9)
+                                    << QByteArray("2a6e0de027d136fda5a293c3fa00bad4");
+    QTest::newRow("G8R8_G8B8 1x1") << QString("G8R8_G8B8") << QSize(1, 1)
+                                   << QByteArray("e3330e0ee60c2d1571bb6673c8088a1e");
+    QTest::newRow("G8R8_G8B8 67x9") << QString("G8R8_G8B8") << QSize(67, 9)
+                                    << QByteArray("33ff557ea7059fb57f533e400fbe9390");
+}
+
+void tst_qdds::testPixels()
+{
+    QFETCH(QString, fileName);
+    QFETCH(QSize, size);
+    QFETCH(QByteArray, checksum);
+
+    QByteArray data = pixelData(fileName, size);
+    QBuffer buffer(&data);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+    QDDSHandler handler;
+    handler.setDevice(&buffer);
+    QImage image;
+    QVERIFY(handler.read(&image));
+    if (size.isValid())
+        QCOMPARE(image.size(), size);
+    QCOMPARE(pixelChecksum(image), checksum);
+}
+
 void tst_qdds::testMipmaps_data()
 {
     QTest::addColumn<QString>("fileName");
@@ -153,6 +655,478 @@ void tst_qdds::testMipmaps()
     }
 }
 
+void tst_qdds::testSubresources_data()
+{
+    QTest::addColumn<QString>("fileName");
+    QTest::addColumn<int>("level");
+    QTest::addColumn<int>("face");
+    QTest::addColumn<QSize>("size");
+    QTest::addColumn<qint64>("offset");
+    QTest::addColumn<qint64>("byteCount");
+    QTest::addColumn<qint64>("rowPitch");
+
+    QTest::newRow("1") << QString("mipmaps") << 0 << 0 << QSize(64, 64)
+                       << qint64(128) << qint64(16384) << qint64(256);
+    QTest::newRow("2") << QString("mipmaps") << 1 << 0 << QSize(32, 32)
+                       << qint64(16512) << qint64(4096) << qint64(128);
+    QTest::newRow("3") << QString("mipmaps") << 6 << 0 << QSize(1, 1)
+                       << qint64(21968) << qint64(4) << qint64(4);
+    QTest::newRow("4") << QString("DXT1") << 0 << 0 << QSize(50, 50)
+                       << qint64(128) << qint64(1352) << qint64(104);
+    QTest::newRow("5") << QString("cubemap") << 0 << 3 << QSize(512, 512)
+                       << qint64(393344) << qint64(131072) << qint64(1024);
+    QTest::newRow("6") << QString("P8") << 0 << 0 << QSize(64, 64)
+                       << qint64(128) << qint64(5120) << qint64(64);
+}
+
+void tst_qdds::testSubresources()
+{
+    QFETCH(QString, fileName);
+    QFETCH(int, level);
+    QFETCH(int, face);
+    QFETCH(QSize, size);
+    QFETCH(qint64, offset);
+    QFETCH(qint64, byteCount);
+    QFETCH(qint64, rowPitch);
+
+    QFile file(QStringLiteral(":/dds/") + fileName + QStringLiteral(".dds"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    QDDSHandler handler;
+    handler.setDevice(&file);
+    const DDSSubresource subresource = handler.subresource(level, face);
+    QVERIFY(subresource.isValid());
+    QCOMPARE(QSize(subresource.width, subresource.height), size);
+    QCOMPARE(subresource.offset, offset);
+    QCOMPARE(subresource.size, byteCount);
+    QCOMPARE(subresource.rowPitch, rowPitch);
+
+    QVERIFY(!handler.subresource(handler.imageCount()).isValid());
+}
+
+void tst_qdds::testReadAsync_data()
+{
+    QTest::addColumn<QString>("fileName");
+
+    QTest::newRow("mipmaps") << QString("mipmaps");
+    QTest::newRow("cubemap") << QString("cubemap");
+}
+
+void tst_qdds::testReadAsync()
+{
+    QFETCH(QString, fileName);
+
+    QFile file(QStringLiteral(":/dds/") + fileName + QStringLiteral(".dds"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    QDDSHandler handler;
+    handler.setDevice(&file);
+
+    QList<QFuture<QImage> > futures;
+    for (int i = 0; i < handler.imageCount(); ++i) {
+        for (int face = 0; face < handler.faceCount(); ++face)
+            futures.append(handler.readAsync(i, face));
+    }
+
+    // Cube maps give single faces, not the cross read() draws
+    for (int i = 0; i < handler.imageCount(); ++i) {
+        for (int face = 0; face < handler.faceCount(); ++face) {
+            QImage image;
+            if (handler.faceCount() == 1) {
+                QVERIFY(handler.jumpToImage(i));
+                QVERIFY(handler.read(&image));
+            } else {
+                image = handler.readRows(0, handler.subresource(i, face).height, i, face);
+            }
+            QCOMPARE(futures.takeFirst().result(), image);
+        }
+    }
+
+    QVERIFY(handler.readAsync(handler.imageCount()).result().isNull());
+
+    // Only the face being decoded counts against the budget
+    const QImage image = handler.readAsync(0).result();
+    handler.setMemoryBudget(qint64(image.bytesPerLine()) * image.height());
+    QCOMPARE(handler.readAsync(0).result(), image);
+    if (handler.faceCount() > 1) {
+        QImage cross;
+        QVERIFY(!handler.read(&cross));
+    }
+}
+
+void tst_qdds::testReadMipmaps()
+{
+    QFile file(QStringLiteral(":/dds/mipmaps.dds"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    QDDSHandler handler;
+    handler.setDevice(&file);
+
+    const QVector<QImage> images = handler.readMipmaps();
+    QCOMPARE(images.size(), handler.imageCount());
+    for (int i = 0; i < handler.imageCount(); ++i) {
+        QImage image;
+        QVERIFY(handler.jumpToImage(i));
+        QVERIFY(handler.read(&image));
+        QCOMPARE(images.at(i), image);
+    }
+
+    // A sequential device is read in one pass
+    QVERIFY(file.seek(0));
+    SequentialDevice device(file.readAll());
+    QVERIFY(device.open(QIODevice::ReadOnly));
+
+    QDDSHandler sequential;
+    sequential.setDevice(&device);
+    QCOMPARE(sequential.readMipmaps(), images);
+
+    // Levels too big for the budget fall back to smaller ones like in read()
+    handler.setMemoryBudget(64 * 64 * 4 - 1, QDDSHandler::FallBackToSmallerMipmap);
+    const QVector<QImage> smaller = handler.readMipmaps();
+    QCOMPARE(smaller.size(), images.size());
+    QCOMPARE(smaller.first(), images.at(1));
+    QCOMPARE(smaller.mid(1), images.mid(1));
+
+    // Mapped levels cost no budget
+    QTemporaryFile mappedFile;
+    QVERIFY(copyFixture(QStringLiteral("mipmaps"), &mappedFile));
+
+    QDDSHandler mapping;
+    mapping.setDevice(&mappedFile);
+    mapping.setMemoryBudget(1);
+    QVERIFY(mapping.readMipmaps().isEmpty());
+    mapping.setImageMappingEnabled(true);
+    QCOMPARE(mapping.readMipmaps(), images);
+}
+
+void tst_qdds::testSequentialDevice()
+{
+    QFile file(QStringLiteral(":/dds/mipmaps.dds"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    SequentialDevice device(file.readAll());
+    QVERIFY(device.open(QIODevice::ReadOnly));
+    QVERIFY(QDDSHandler::canRead(&device));
+
+    QDDSHandler handler;
+    handler.setDevice(&device);
+    QCOMPARE(handler.imageCount(), 7);
+
+    QImageReader reader(file.fileName());
+    for (int i = 0; i < handler.imageCount(); i += 2) {
+        QImage image;
+        QVERIFY(handler.jumpToImage(i));
+        QVERIFY(handler.read(&image));
+        QVERIFY(reader.jumpToImage(i));
+        QCOMPARE(image, reader.read());
+    }
+
+    // Levels that were already consumed can't be read again
+    QImage image;
+    QVERIFY(handler.jumpToImage(0));
+    QVERIFY(!handler.read(&image));
+}
+
+void tst_qdds::testChunkedDevice_data()
+{
+    QTest::addColumn<QByteArray>("data");
+    QTest::addColumn<int>("arraySize");
+
+    QFile file(QStringLiteral(":/dds/mipmaps.dds"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QTest::newRow("mipmaps") << file.readAll() << 1;
+    QTest::newRow("DX10") << layoutData(4, 1, 4) << 4;
+}
+
+void tst_qdds::testChunkedDevice()
+{
+    QFETCH(QByteArray, data);
+    QFETCH(int, arraySize);
+
+    // The headers arrive over several reads
+    SequentialDevice whole(data);
+    SequentialDevice chunked(data, 7);
+    QVERIFY(whole.open(QIODevice::ReadOnly));
+    QVERIFY(chunked.open(QIODevice::ReadOnly));
+
+    QDDSHandler expected;
+    expected.setDevice(&whole);
+    QDDSHandler handler;
+    handler.setDevice(&chunked);
+    QCOMPARE(handler.imageCount(), expected.imageCount());
+    QCOMPARE(handler.arraySize(), arraySize);
+
+    QImage image;
+    QImage expectedImage;
+    QVERIFY(expected.read(&expectedImage));
+    QVERIFY(handler.read(&image));
+    QCOMPARE(image, expectedImage);
+}
+
+void tst_qdds::testLayoutCache()
+{
+    QDDSHandler::setLayoutCacheSize(16);
+    QCOMPARE(QDDSHandler::layoutCacheHits(), 0);
+    QCOMPARE(QDDSHandler::layoutCacheMisses(), 0);
+
+    for (int i = 0; i < 2; ++i) {
+        QFile file(QStringLiteral(":/dds/cubemap.dds"));
+        QVERIFY(file.open(QIODevice::ReadOnly));
+
+        QDDSHandler handler;
+        handler.setDevice(&file);
+        QCOMPARE(handler.imageCount(), 1);
+        QCOMPARE(handler.faceCount(), 6);
+        QCOMPARE(handler.subresource(0, 3).offset, qint64(393344));
+        QCOMPARE(QDDSHandler::layoutCacheHits(), i);
+        QCOMPARE(QDDSHandler::layoutCacheMisses(), 1);
+
+        QImage image;
+        QVERIFY(handler.read(&image));
+        QCOMPARE(image.size(), QSize(2048, 1536));
+    }
+
+    // Any change to the file invalidates its entry
+    QTemporaryFile file;
+    QVERIFY(copyFixture(QStringLiteral("mipmaps"), &file));
+
+    for (int i = 0; i < 2; ++i) {
+        QDDSHandler handler;
+        handler.setDevice(&file);
+        QCOMPARE(handler.imageCount(), 7);
+    }
+    QCOMPARE(QDDSHandler::layoutCacheHits(), 2);
+    QCOMPARE(QDDSHandler::layoutCacheMisses(), 2);
+
+    QVERIFY(file.seek(file.size()));
+    QCOMPARE(file.write("\0", 1), qint64(1));
+    QVERIFY(file.flush());
+    {
+        QDDSHandler handler;
+        handler.setDevice(&file);
+        QCOMPARE(handler.imageCount(), 7);
+        QCOMPARE(QDDSHandler::layoutCacheHits(), 2);
+        QCOMPARE(QDDSHandler::layoutCacheMisses(), 3);
+    }
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    const QDateTime modified = file.fileTime(QFileDevice::FileModificationTime);
+    QVERIFY(file.setFileTime(modified.addSecs(2), QFileDevice::FileModificationTime));
+    {
+        QDDSHandler handler;
+        handler.setDevice(&file);
+        QCOMPARE(handler.imageCount(), 7);
+        QCOMPARE(QDDSHandler::layoutCacheHits(), 2);
+        QCOMPARE(QDDSHandler::layoutCacheMisses(), 4);
+    }
+#endif
+
+    QDDSHandler::setLayoutCacheSize(0);
+    QCOMPARE(QDDSHandler::layoutCacheSize(), 0);
+}
+
+void tst_qdds::testMemoryBudget()
+{
+    QFile file(QStringLiteral(":/dds/mipmaps.dds"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    QDDSHandler handler;
+    handler.setDevice(&file);
+
+    QImage image;
+    handler.setMemoryBudget(32 * 32 * 4);
+    QVERIFY(!handler.read(&image));
+
+    handler.setMemoryBudget(32 * 32 * 4, QDDSHandler::FallBackToSmallerMipmap);
+    QVERIFY(handler.read(&image));
+    QCOMPARE(image.size(), QSize(32, 32));
+
+    handler.setMemoryBudget(0);
+    QVERIFY(handler.read(&image));
+    QCOMPARE(image.size(), QSize(64, 64));
+
+    // readRows() counts the rows it returns on top of the strip it decodes
+    handler.setMemoryBudget(2 * 64 * 8 * 4 - 1);
+    QVERIFY(handler.readRows(0, 8).isNull());
+    handler.setMemoryBudget(2 * 64 * 8 * 4);
+    QCOMPARE(handler.readRows(0, 8).size(), QSize(64, 8));
+
+    // Images that QImage can't hold are refused before anything is read,
+    // even without a budget
+    SequentialDevice device(layoutData(1, 1, 0, QSize(65535, 65535)));
+    QVERIFY(device.open(QIODevice::ReadOnly));
+    QDDSHandler huge;
+    huge.setDevice(&device);
+    QCOMPARE(huge.imageCount(), 1);
+    QVERIFY(!huge.read(&image));
+}
+
+void tst_qdds::testStrips_data()
+{
+    QTest::addColumn<QString>("fileName");
+    QTest::addColumn<int>("stripHeight");
+    QTest::addColumn<int>("maxHeight");
+
+    QTest::newRow("1") << QString("DXT1") << 8 << 8;
+    QTest::newRow("2") << QString("DXT5") << 6 << 8;
+    QTest::newRow("3") << QString("A8R8G8B8") << 5 << 5;
+    QTest::newRow("4") << QString("P8") << 16 << 16;
+}
+
+void tst_qdds::testStrips()
+{
+    QFETCH(QString, fileName);
+    QFETCH(int, stripHeight);
+    QFETCH(int, maxHeight);
+
+    QFile file(QStringLiteral(":/dds/") + fileName + QStringLiteral(".dds"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    QDDSHandler handler;
+    handler.setDevice(&file);
+
+    QImage expected;
+    QVERIFY(handler.read(&expected));
+
+    StripCollector collector(expected.size());
+    QVERIFY(handler.readStrips(&collector, stripHeight));
+    QCOMPARE(collector.maxHeight, maxHeight);
+    collector.image.setColorTable(expected.colorTable());
+    QCOMPARE(collector.image, expected);
+
+    QCOMPARE(handler.readRows(5, 20), expected.copy(0, 5, expected.width(), 20));
+}
+
+void tst_qdds::testReadInPlace()
+{
+    QImageReader reader(QStringLiteral(":/dds/DXT5.dds"));
+    QVERIFY(reader.supportsOption(QImageIOHandler::ImageFormat));
+    QCOMPARE(reader.imageFormat(), QImage::Format_ARGB32);
+    const QImage expected = reader.read();
+
+    QFile file(reader.fileName());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    QDDSHandler handler;
+    handler.setDevice(&file);
+
+    QImage image(expected.size(), QImage::Format_ARGB32);
+    image.fill(Qt::red);
+    const uchar *bits = image.constBits();
+    QVERIFY(handler.read(&image));
+    QCOMPARE(image.constBits(), bits);
+    QCOMPARE(image, expected);
+
+    // A read refused before decoding starts leaves the image alone, whether
+    // it's over budget or the data is cut short
+    handler.setMemoryBudget(1);
+    QVERIFY(!handler.read(&image));
+    QCOMPARE(image.constBits(), bits);
+    QCOMPARE(image, expected);
+
+    QVERIFY(file.seek(0));
+    QBuffer truncated;
+    truncated.setData(file.read(file.size() / 2));
+    QVERIFY(truncated.open(QIODevice::ReadOnly));
+    QDDSHandler truncatedHandler;
+    truncatedHandler.setDevice(&truncated);
+    QVERIFY(!truncatedHandler.read(&image));
+    QCOMPARE(image.constBits(), bits);
+    QCOMPARE(image, expected);
+}
+
+void tst_qdds::testYuvMatrix()
+{
+    // Y0, U, Y1, V of the pixel pair in each row
+    static const uchar samples[4][4] = {
+        { 128, 128, 128, 128 },
+        { 81, 90, 145, 240 },
+        { 41, 240, 210, 110 },
+        { 16, 0, 235, 255 }
+    };
+
+    // The pairs converted with the BT.601 and BT.709 matrices, rounded
+    static const QRgb expected[2][4][2] = {
+        {
+            { qRgb(128, 128, 128), qRgb(128, 128, 128) },
+            { qRgb(209, 31, 4), qRgb(255, 95, 68) },
+            { qRgb(20, 7, 255), qRgb(189, 176, 255) },
+            { qRgb(161, 0, 0), qRgb(255, 212, 0) }
+        },
+        {
+            { qRgb(128, 128, 128), qRgb(128, 128, 128) },
+            { qRgb(224, 47, 0), qRgb(255, 111, 64) },
+            { qRgb(18, 24, 255), qRgb(187, 193, 255) },
+            { qRgb(179, 0, 0), qRgb(255, 214, 0) }
+        }
+    };
+
+    QByteArray yuy2;
+    QByteArray uyvy;
+    for (int row = 0; row < 4; row++) {
+        const uchar *s = samples[row];
+        const char yuy2Pair[4] = { char(s[0]), char(s[1]), char(s[2]), char(s[3]) };
+        const char uyvyPair[4] = { char(s[1]), char(s[0]), char(s[3]), char(s[2]) };
+        yuy2.append(yuy2Pair, 4);
+        uyvy.append(uyvyPair, 4);
+    }
+
+    const char *const names[2] = { "YUY2", "UYVY" };
+    const QByteArray pixels[2] = { yuy2, uyvy };
+    for (int i = 0; i < 2; i++) {
+        for (int m = 0; m < 2; m++) {
+            QByteArray data = pixelData(QString::fromLatin1(names[i]), QSize(2, 4), pixels[i]);
+            QBuffer buffer(&data);
+            QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+            QDDSHandler handler;
+            handler.setDevice(&buffer);
+            QCOMPARE(handler.yuvMatrix(), QDDSHandler::YuvMatrixBt601);
+            if (m)
+                handler.setYuvMatrix(QDDSHandler::YuvMatrixBt709);
+
+            QImage image;
+            QVERIFY(handler.read(&image));
+            QCOMPARE(image.size(), QSize(2, 4));
+            for (int y = 0; y < 4; y++) {
+                QCOMPARE(image.pixel(0, y), expected[m][y][0]);
+                QCOMPARE(image.pixel(1, y), expected[m][y][1]);
+            }
+        }
+    }
+}
+
+void tst_qdds::testPaletteExpansion_data()
+{
+    QTest::addColumn<QString>("fileName");
+
+    QTest::newRow("P8") << QString("P8");
+    QTest::newRow("P4") << QString("P4");
+}
+
+void tst_qdds::testPaletteExpansion()
+{
+    QFETCH(QString, fileName);
+
+    const QString path = QStringLiteral(":/dds/") + fileName + QStringLiteral(".dds");
+    const QImage indexed(path);
+    QCOMPARE(indexed.format(), QImage::Format_Indexed8);
+
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    QDDSHandler handler;
+    handler.setDevice(&file);
+    QVERIFY(!handler.isPaletteExpansionEnabled());
+    handler.setPaletteExpansionEnabled(true);
+    QCOMPARE(handler.option(QImageIOHandler::ImageFormat).toInt(), int(QImage::Format_ARGB32));
+
+    QImage image;
+    QVERIFY(handler.read(&image));
+    QCOMPARE(image.format(), QImage::Format_ARGB32);
+    QCOMPARE(image, indexed.convertToFormat(QImage::Format_ARGB32));
+}
+
 void tst_qdds::testWriteImage_data()
 {
     QTest::addColumn<QString>("fileName");
@@ -188,5 +1162,194 @@ void tst_qdds::testWriteImage()
     QCOMPARE(reader.subType(), subType);
 }
 
+void tst_qdds::testDevices_data()
+{
+    QTest::addColumn<QString>("fileName");
+
+    QTest::newRow("mipmaps") << QString("mipmaps");
+    QTest::newRow("DXT1") << QString("DXT1");
+    QTest::newRow("A8R8G8B8") << QString("A8R8G8B8");
+    QTest::newRow("P8") << QString("P8");
+}
+
+void tst_qdds::testDevices()
+{
+    QFETCH(QString, fileName);
+
+    // QFile may be mapped, QBuffer is read in place, anything else is copied
+    QFile file(QStringLiteral(":/dds/") + fileName + QStringLiteral(".dds"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray data = file.readAll();
+    QVERIFY(file.seek(0));
+
+    QBuffer buffer;
+    buffer.setData(data);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+    RandomAccessDevice device(data);
+    QVERIFY(device.open(QIODevice::ReadOnly));
+
+    QImageReader readers[3];
+    QIODevice *const devices[3] = { &file, &buffer, &device };
+    for (int i = 0; i < 3; ++i) {
+        readers[i].setDevice(devices[i]);
+        readers[i].setFormat("dds");
+    }
+
+    QVERIFY(readers[0].imageCount() > 0);
+    for (int level = 0; level < readers[0].imageCount(); ++level) {
+        QImage images[3];
+        for (int i = 0; i < 3; ++i) {
+            QVERIFY(readers[i].jumpToImage(level));
+            images[i] = readers[i].read();
+            QVERIFY2(!images[i].isNull(), qPrintable(readers[i].errorString()));
+        }
+        QCOMPARE(images[1], images[0]);
+        QCOMPARE(images[2], images[0]);
+    }
+}
+
+void tst_qdds::testImageMapping_data()
+{
+    QTest::addColumn<QString>("fileName");
+    QTest::addColumn<int>("mappedFormat");
+
+    // Format_Invalid for formats that are decoded even with mapping on.
+    // X8R8G8B8 files leave the X bytes zero, which RGB32 doesn't allow.
+    QTest::newRow("A8R8G8B8") << QString("A8R8G8B8") << int(QImage::Format_ARGB32);
+    QTest::newRow("A8R8G8B8.2") << QString("A8R8G8B8.2") << int(QImage::Format_ARGB32);
+    QTest::newRow("R5G6B5") << QString("R5G6B5") << int(QImage::Format_RGB16);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    QTest::newRow("L8") << QString("L8") << int(QImage::Format_Grayscale8);
+    QTest::newRow("A8") << QString("A8") << int(QImage::Format_Alpha8);
+#endif
+    QTest::newRow("X8R8G8B8") << QString("X8R8G8B8") << int(QImage::Format_Invalid);
+    QTest::newRow("DXT1") << QString("DXT1") << int(QImage::Format_Invalid);
+    QTest::newRow("P8") << QString("P8") << int(QImage::Format_Invalid);
+}
+
+void tst_qdds::testImageMapping()
+{
+    QFETCH(QString, fileName);
+    QFETCH(int, mappedFormat);
+
+    // Resources can't always be mapped, use a real file
+    QTemporaryFile file;
+    QVERIFY(copyFixture(fileName, &file));
+
+    QDDSHandler handler;
+    handler.setDevice(&file);
+    QVERIFY(!handler.isImageMappingEnabled());
+    QImage expected;
+    QVERIFY(handler.read(&expected));
+
+    handler.setImageMappingEnabled(true);
+    QImage image;
+    QVERIFY(handler.read(&image));
+    const uchar *bits = image.constBits();
+    image.bits();
+
+    // Formats that can't be mapped fall back to decoding a writable copy
+    if (mappedFormat == QImage::Format_Invalid) {
+        QCOMPARE(image.constBits(), bits);
+        QCOMPARE(image, expected);
+        if (fileName == QStringLiteral("X8R8G8B8")) {
+            QCOMPARE(qAlpha(image.pixel(0, 0)), 255);
+            QCOMPARE(image.convertToFormat(QImage::Format_ARGB32),
+                     expected.convertToFormat(QImage::Format_ARGB32));
+        }
+        return;
+    }
+
+    // A mapped image is read-only, has the file's stride and costs no budget
+    const QImage::Format format = QImage::Format(mappedFormat);
+    QVERIFY(image.constBits() != bits);
+    QCOMPARE(image.format(), format);
+    QCOMPARE(image.bytesPerLine(), image.width() * image.depth() / 8);
+    QCOMPARE(image, expected.convertToFormat(format));
+
+    handler.setMemoryBudget(1);
+    QVERIFY(handler.read(&image));
+    QCOMPARE(image.format(), format);
+    QCOMPARE(image, expected.convertToFormat(format));
+    handler.setImageMappingEnabled(false);
+    QVERIFY(!handler.read(&image));
+}
+
+void tst_qdds::testPrefetch_data()
+{
+    QTest::addColumn<QString>("fileName");
+
+    QTest::newRow("mipmaps") << QString("mipmaps");
+    QTest::newRow("cubemap") << QString("cubemap");
+}
+
+void tst_qdds::testPrefetch()
+{
+    QFETCH(QString, fileName);
+
+    // Resources have no file handle to give advice on, use a real file
+    QTemporaryFile file;
+    QVERIFY(copyFixture(fileName, &file));
+
+    // Prefetching is only a hint, the decoded levels must not change
+    QVector<QImage> images[2];
+    const int depths[2] = { 0, 2 };
+    for (int i = 0; i < 2; ++i) {
+        QVERIFY(file.seek(0));
+
+        QDDSHandler handler;
+        handler.setDevice(&file);
+        handler.setPrefetchDepth(depths[i]);
+        QCOMPARE(handler.prefetchDepth(), depths[i]);
+        for (int level = 0; level < handler.imageCount(); ++level) {
+            QImage image;
+            QVERIFY(handler.jumpToImage(level));
+            QVERIFY(handler.read(&image));
+            images[i].append(image);
+        }
+    }
+
+    QVERIFY(!images[0].isEmpty());
+    QCOMPARE(images[1], images[0]);
+}
+
+void tst_qdds::testLayoutLimits_data()
+{
+    QTest::addColumn<quint32>("arraySize");
+    QTest::addColumn<quint32>("depth");
+    QTest::addColumn<bool>("valid");
+
+    QTest::newRow("array") << quint32(2048) << quint32(1) << true;
+    QTest::newRow("large array") << quint32(2049) << quint32(1) << false;
+    QTest::newRow("huge array") << (quint32(1) << 30) << quint32(1) << false;
+    QTest::newRow("volume") << quint32(1) << quint32(2048) << true;
+    QTest::newRow("large volume") << quint32(1) << quint32(2049) << false;
+    QTest::newRow("huge volume") << quint32(1) << (quint32(1) << 30) << false;
+    QTest::newRow("array of volumes") << quint32(2048) << quint32(2048) << false;
+}
+
+void tst_qdds::testLayoutLimits()
+{
+    QFETCH(quint32, arraySize);
+    QFETCH(quint32, depth);
+    QFETCH(bool, valid);
+
+    // The device size can't bound the layout of a sequential device
+    const int count = valid ? int(arraySize * depth) : 1;
+    SequentialDevice device(layoutData(arraySize, depth, count));
+    QVERIFY(device.open(QIODevice::ReadOnly));
+
+    QDDSHandler handler;
+    handler.setDevice(&device);
+    QCOMPARE(handler.imageCount() > 0, valid);
+    if (!valid)
+        return;
+
+    QCOMPARE(handler.arraySize(), int(arraySize));
+    QCOMPARE(handler.depth(), int(depth));
+    QVERIFY(handler.subresource(0, 0, int(arraySize) - 1, int(depth) - 1).isValid());
+}
+
 QTEST_MAIN(tst_qdds)
 #include "tst_qdds.moc"